@@ -0,0 +1,133 @@
+#ifndef BAYESIAN_UPDATER_H
+#define BAYESIAN_UPDATER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "probability_space.h"
+
+
+/**
+ * @brief Posterior of a prior after a stream of observations, tracked in log-space.
+ *
+ * Every observation adds the logarithm of its likelihood to a running log-likelihood
+ * per outcome and nothing else: renormalization is delayed until posterior() or
+ * logEvidence() is asked for. A product of many small likelihoods would underflow to
+ * 0 after a few hundred observations, while the sums of their logarithms stay in
+ * range; the posterior shifts them by the largest one before exponentiating, so the
+ * most likely outcomes are always represented exactly.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class BayesianUpdater {
+private:
+    ProbabilitySpace<T> prior;
+    // Sum of the log-likelihoods of all observations, per outcome
+    std::vector<double> logLikelihood;
+    std::size_t count = 0;
+
+    void addLog(const double* logs) {
+        for (std::size_t i = 0; i < logLikelihood.size(); ++i) {
+            if (std::isnan(logs[i]) || logs[i] == std::numeric_limits<double>::infinity())
+                throw std::invalid_argument("Log-likelihoods must be finite or -infinity");
+        }
+        for (std::size_t i = 0; i < logLikelihood.size(); ++i) logLikelihood[i] += logs[i];
+        ++count;
+    }
+
+    // Largest log-likelihood of an outcome the prior doesn't rule out
+    double shift() const {
+        double result = -std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < logLikelihood.size(); ++i) {
+            if (prior.probabilityAt(i) > 0.0) result = std::max(result, logLikelihood[i]);
+        }
+        if (result == -std::numeric_limits<double>::infinity())
+            throw std::invalid_argument("Observation has probability 0 under the prior");
+        return result;
+    }
+
+public:
+    explicit BayesianUpdater(const ProbabilitySpace<T>& prior)
+        : prior(prior), logLikelihood(prior.size(), 0.0) {}
+
+    /**
+     * @brief Add an observation.
+     *
+     * @param likelihood likelihood[i] is the likelihood of the observation given the
+     * i-th outcome in ascending order, up to a constant factor.
+     * @throws std::invalid_argument if there isn't exactly one nonnegative finite
+     * likelihood per outcome.
+     */
+    void observe(const std::vector<double>& likelihood) {
+        if (likelihood.size() != logLikelihood.size())
+            throw std::invalid_argument("Every outcome needs exactly one likelihood");
+        std::vector<double> logs(likelihood.size());
+        for (std::size_t i = 0; i < logs.size(); ++i) {
+            if (!(likelihood[i] >= 0.0 && likelihood[i] <= std::numeric_limits<double>::max()))
+                throw std::invalid_argument("Likelihoods must be nonnegative and finite");
+            logs[i] = std::log(likelihood[i]);
+        }
+        addLog(logs.data());
+    }
+
+    /**
+     * @brief Add an observation given by the logarithms of its likelihoods.
+     *
+     * Log-likelihoods of models such as a Gaussian can be far below the smallest
+     * double and still be added exactly this way. -infinity rules an outcome out.
+     *
+     * @throws std::invalid_argument if there isn't exactly one log-likelihood per
+     * outcome or one is NaN or +infinity.
+     */
+    void observeLog(const std::vector<double>& logs) {
+        if (logs.size() != logLikelihood.size())
+            throw std::invalid_argument("Every outcome needs exactly one likelihood");
+        addLog(logs.data());
+    }
+
+    // Number of observations so far
+    std::size_t observations() const {
+        return count;
+    }
+
+    /**
+     * @brief Calculate log P(observations), the log of the evidence of the stream.
+     *
+     * @throws std::invalid_argument if the observations have probability 0 under the prior.
+     */
+    double logEvidence() const {
+        double m = shift();
+        double sum = 0.0;
+        for (std::size_t i = 0; i < logLikelihood.size(); ++i) {
+            // Outcomes the prior rules out may lie above the shift and overflow
+            if (prior.probabilityAt(i) > 0.0) sum += prior.probabilityAt(i) * std::exp(logLikelihood[i] - m);
+        }
+        return m + std::log(sum);
+    }
+
+    /**
+     * @brief The posterior after all observations so far.
+     *
+     * @throws std::invalid_argument if the observations have probability 0 under the prior.
+     */
+    ProbabilitySpace<T> posterior() const {
+        double m = shift();
+        std::vector<double> likelihood(logLikelihood.size());
+        for (std::size_t i = 0; i < likelihood.size(); ++i)
+            likelihood[i] = prior.probabilityAt(i) > 0.0 ? std::exp(logLikelihood[i] - m) : 0.0;
+        return prior.bayesUpdate(likelihood);
+    }
+
+    // Forget all observations
+    void reset() {
+        std::fill(logLikelihood.begin(), logLikelihood.end(), 0.0);
+        count = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "probability_space.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+// Count every heap allocation made by the benchmarked code, so that results
+// can be compared by allocations as well as by time.
+static std::atomic<std::size_t> allocationCount{0};
+static std::atomic<std::size_t> allocatedBytes{0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+// Kept out of line so that GCC doesn't match the inlined free() against the
+// builtin operator new and warn about a mismatch.
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// Outcome type standing in for user-defined structs
+struct Point {
+    int x;
+    int y;
+
+    bool operator<(const Point& other) const {
+        return x < other.x || (x == other.x && y < other.y);
+    }
+};
+
+template <typename T>
+T makeOutcome(std::size_t i);
+
+template <>
+int makeOutcome<int>(std::size_t i) { return static_cast<int>(i); }
+
+template <>
+std::string makeOutcome<std::string>(std::size_t i) { return "outcome-" + std::to_string(i); }
+
+template <>
+Point makeOutcome<Point>(std::size_t i) { return {static_cast<int>(i / 1000), static_cast<int>(i % 1000)}; }
+
+struct Measurement {
+    std::size_t iterations = 0;
+    double nsPerOp = 0.0;
+    double allocationsPerOp = 0.0;
+    double bytesPerOp = 0.0;
+};
+
+// Minimum time spent on each measurement
+constexpr double MIN_SECONDS = 0.05;
+
+// Repeat op until MIN_SECONDS have passed, at least once.
+template <typename Op>
+Measurement measure(Op op) {
+    using Clock = std::chrono::steady_clock;
+    std::size_t allocations = allocationCount.load();
+    std::size_t bytes = allocatedBytes.load();
+    std::size_t iterations = 0;
+    auto start = Clock::now();
+    double elapsed = 0.0;
+    while (iterations == 0 || elapsed < MIN_SECONDS) {
+        op();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    Measurement m;
+    m.iterations = iterations;
+    m.nsPerOp = elapsed * 1e9 / iterations;
+    m.allocationsPerOp = double(allocationCount.load() - allocations) / iterations;
+    m.bytesPerOp = double(allocatedBytes.load() - bytes) / iterations;
+    return m;
+}
+
+// Keep results alive so that the compiler can't drop the benchmarked calls
+static volatile double sink = 0.0;
+
+static bool firstRecord = true;
+
+void report(const char* type, std::size_t size, double density, const char* operation, const Measurement& m) {
+    std::printf("%s\n    {\"type\": \"%s\", \"size\": %zu, \"density\": %g, \"operation\": \"%s\", "
+                "\"iterations\": %zu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.1f, "
+                "\"allocations_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+                firstRecord ? "" : ",", type, size, density, operation,
+                m.iterations, m.nsPerOp, 1e9 / m.nsPerOp, m.allocationsPerOp, m.bytesPerOp);
+    firstRecord = false;
+    std::fflush(stdout);
+}
+
+// The event of every stride-th outcome, starting from offset
+template <typename T>
+std::set<T> strideEvent(std::size_t size, std::size_t stride, std::size_t offset) {
+    std::set<T> event;
+    for (std::size_t i = offset; i < size; i += stride) event.insert(makeOutcome<T>(i));
+    return event;
+}
+
+template <typename T>
+void benchType(const char* type, std::size_t maxSize, const std::vector<double>& densities) {
+    for (std::size_t size = 10; size <= maxSize; size *= 10) {
+        std::map<T, double> mapping;
+        for (std::size_t i = 0; i < size; ++i) mapping.emplace(makeOutcome<T>(i), 1.0 / size);
+
+        report(type, size, 1.0, "construction", measure([&]{
+            ProbabilitySpace<T> ps(mapping);
+            sink = sink + ps.size();
+        }));
+
+        ProbabilitySpace<T> ps(mapping);
+        mapping.clear();
+
+        for (double density : densities) {
+            std::size_t stride = std::max<std::size_t>(1, static_cast<std::size_t>(1.0 / density));
+            if (size / stride == 0) continue;
+            std::set<T> eventA = strideEvent<T>(size, stride, 0);
+            std::set<T> eventB = strideEvent<T>(size, 2, 0);
+
+            report(type, size, density, "probabilityOfSet", measure([&]{
+                sink = sink + ps.probabilityOfSet(eventA);
+            }));
+            report(type, size, density, "unionOfEvents", measure([&]{
+                sink = sink + ps.unionOfEvents(eventA, eventB);
+            }));
+            report(type, size, density, "intersectionOfEvents", measure([&]{
+                sink = sink + ps.intersectionOfEvents(eventA, eventB);
+            }));
+            report(type, size, density, "conditionalProbability", measure([&]{
+                sink = sink + ps.conditionalProbability(eventA, eventB);
+            }));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::size_t maxSize = 10000000;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            maxSize = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--max-size N]" << std::endl;
+            return 1;
+        }
+    }
+
+    const std::vector<double> densities = {0.001, 0.01, 0.1, 0.5};
+
+    std::printf("{\n  \"benchmark\": \"probability-engine\",\n  \"max_size\": %zu,\n  \"results\": [", maxSize);
+    benchType<int>("int", maxSize, densities);
+    benchType<std::string>("string", maxSize, densities);
+    benchType<Point>("struct", maxSize, densities);
+    std::printf("\n  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,334 @@
+#ifndef DISTRIBUTIONS_H
+#define DISTRIBUTIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "probability_space.h"
+#include "summation.h"
+
+
+/**
+ * @brief Calculate the regularized incomplete beta function I_x(a, b).
+ *
+ * Evaluates the continued fraction of I_x(a, b) with the modified Lentz method,
+ * on the side of x where it converges quickly. The result is accurate to about
+ * a + b units of rounding, which is the error of the log-gamma terms of its prefactor.
+ *
+ * @return I_x(a, b), or NaN if the fraction doesn't converge.
+ */
+inline double regularizedBeta(double a, double b, double x) {
+    if (x <= 0.0) return 0.0;
+    if (x >= 1.0) return 1.0;
+    bool flipped = x > (a + 1.0) / (a + b + 2.0);
+    if (flipped) {
+        std::swap(a, b);
+        x = 1.0 - x;
+    }
+
+    constexpr double TINY = 1e-300;
+    constexpr double TOLERANCE = 1e-15;
+    constexpr int MAX_ITERATIONS = 100000;
+    double c = 1.0;
+    double d = 1.0 - (a + b) * x / (a + 1.0);
+    if (std::abs(d) < TINY) d = TINY;
+    d = 1.0 / d;
+    double fraction = d;
+    bool converged = false;
+    for (int m = 1; m <= MAX_ITERATIONS && !converged; ++m) {
+        double even = m * (b - m) * x / ((a + 2.0 * m - 1.0) * (a + 2.0 * m));
+        d = 1.0 + even * d;
+        if (std::abs(d) < TINY) d = TINY;
+        c = 1.0 + even / c;
+        if (std::abs(c) < TINY) c = TINY;
+        d = 1.0 / d;
+        fraction *= d * c;
+        double odd = -(a + m) * (a + b + m) * x / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+        d = 1.0 + odd * d;
+        if (std::abs(d) < TINY) d = TINY;
+        c = 1.0 + odd / c;
+        if (std::abs(c) < TINY) c = TINY;
+        d = 1.0 / d;
+        double step = d * c;
+        fraction *= step;
+        converged = std::abs(step - 1.0) < TOLERANCE;
+    }
+    if (!converged) return std::numeric_limits<double>::quiet_NaN();
+
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log1p(-x));
+    double result = front * fraction / a;
+    return flipped ? 1.0 - result : result;
+}
+
+enum class DistributionFamily { Uniform, Binomial, Poisson, Geometric };
+
+// Most outcomes a distribution table may have. Factories whose truncated support
+// would be longer reject their parameters instead of exhausting memory.
+constexpr std::size_t MAX_DISTRIBUTION_TABLE = std::size_t{1} << 24;
+
+/**
+ * @brief A standard discrete distribution over the integers, with its table and its closed forms.
+ *
+ * Created by the factories uniformDistribution(), binomialDistribution(),
+ * poissonDistribution() and geometricDistribution(). The probability table is
+ * generated straight into the dense storage of a ProbabilitySpace<int>: outward from
+ * the mode with the ratio of neighbouring probabilities, one multiplication per
+ * outcome, and normalized by construction, so it isn't validated again.
+ *
+ * Tails whose mass is below half the truncation tolerance on either side are left
+ * out. The truncated masses are bounded with a geometric series of the current
+ * ratio, which only shrinks away from the mode for these log-concave distributions,
+ * so infinite supports stay bounded in memory. The table is renormalized to the
+ * outcomes kept.
+ *
+ * Ranges and the CDF are calculated in closed form where the family has one, for
+ * the distribution truncated the same way as the table: exactly for uniform and
+ * geometric, with the regularized incomplete beta function for binomial. Poisson
+ * queries, and binomial ones whose continued fraction doesn't converge, use the table.
+ */
+class DiscreteDistribution {
+private:
+    ProbabilitySpace<int> space;
+    DistributionFamily family;
+    long long trials;
+    double parameter;
+    long long first;
+    long long last;
+    // P(first <= X <= last) before truncation
+    double keptMass = 1.0;
+
+    DiscreteDistribution(DistributionFamily family, long long trials, double parameter,
+                         std::vector<int> keys, std::vector<double> probs)
+        : space(normalized(std::move(keys), std::move(probs))), family(family), trials(trials), parameter(parameter) {
+        first = space.outcomeAt(0);
+        last = space.outcomeAt(space.size() - 1);
+        keptMass = 1.0 - below(first) - above(last);
+    }
+
+    static ProbabilitySpace<int> normalized(std::vector<int> keys, std::vector<double> probs) {
+        BlockedSum<NeumaierSum> total;
+        for (double p : probs) total.add(p);
+        double scale = 1.0 / total.result();
+        for (double& p : probs) p *= scale;
+        return ProbabilitySpace<int>(ProbabilitySpace<int>::TrustedTag{}, std::move(keys), std::move(probs));
+    }
+
+    static void validTableLength(double length) {
+        if (!(length <= static_cast<double>(MAX_DISTRIBUTION_TABLE)))
+            throw std::invalid_argument("Distribution table would exceed MAX_DISTRIBUTION_TABLE outcomes");
+    }
+
+    static void validTolerance(double tolerance, bool infinite) {
+        if (!(tolerance >= 0.0 && tolerance < 1.0))
+            throw std::invalid_argument("Truncation tolerance must be in [0, 1)");
+        if (infinite && tolerance == 0.0)
+            throw std::invalid_argument("Infinite supports need a positive truncation tolerance");
+    }
+
+    /**
+     * @brief Generate the table of [lo, hi] outward from the mode.
+     *
+     * @param up(k) P(k + 1) / P(k).
+     * @param down(k) P(k - 1) / P(k).
+     * @param tail Largest mass to leave out on each side.
+     * @throws std::invalid_argument once the table grows past MAX_DISTRIBUTION_TABLE
+     * outcomes, so supports without an up-front bound cost at most that many steps.
+     */
+    template <typename Up, typename Down>
+    static void fromMode(long long mode, double pmfMode, long long lo, long long hi, Up up, Down down, double tail,
+                         std::vector<int>& keys, std::vector<double>& probs) {
+        std::vector<double> left;
+        double value = pmfMode;
+        for (long long k = mode; k > lo; --k) {
+            double ratio = down(k);
+            if (ratio < 1.0 && value * ratio / (1.0 - ratio) <= tail) break;
+            value *= ratio;
+            left.push_back(value);
+            validTableLength(static_cast<double>(left.size() + 1));
+        }
+        keys.reserve(left.size() + 1);
+        probs.reserve(left.size() + 1);
+        for (std::size_t j = left.size(); j > 0; --j) {
+            keys.push_back(static_cast<int>(mode - static_cast<long long>(j)));
+            probs.push_back(left[j - 1]);
+        }
+        keys.push_back(static_cast<int>(mode));
+        probs.push_back(pmfMode);
+        value = pmfMode;
+        for (long long k = mode; k < hi; ++k) {
+            double ratio = up(k);
+            if (ratio < 1.0 && value * ratio / (1.0 - ratio) <= tail) break;
+            value *= ratio;
+            keys.push_back(static_cast<int>(k + 1));
+            probs.push_back(value);
+            validTableLength(static_cast<double>(keys.size()));
+        }
+    }
+
+    // P(X < k) and P(X > k) before truncation, NaN without a closed form
+    double below(long long k) const {
+        switch (family) {
+            case DistributionFamily::Binomial:
+                if (k <= 0) return 0.0;
+                if (k > trials) return 1.0;
+                return regularizedBeta(static_cast<double>(trials - k + 1), static_cast<double>(k), 1.0 - parameter);
+            case DistributionFamily::Geometric:
+                if (k <= 1) return 0.0;
+                return -std::expm1(static_cast<double>(k - 1) * std::log1p(-parameter));
+            case DistributionFamily::Poisson:
+                return std::numeric_limits<double>::quiet_NaN();
+            default:
+                return 0.0;
+        }
+    }
+
+    double above(long long k) const {
+        switch (family) {
+            case DistributionFamily::Binomial:
+                if (k < 0) return 1.0;
+                if (k >= trials) return 0.0;
+                return regularizedBeta(static_cast<double>(k + 1), static_cast<double>(trials - k), parameter);
+            case DistributionFamily::Geometric:
+                if (k < 1) return 1.0;
+                return std::exp(static_cast<double>(k) * std::log1p(-parameter));
+            case DistributionFamily::Poisson:
+                return std::numeric_limits<double>::quiet_NaN();
+            default:
+                return 0.0;
+        }
+    }
+
+    friend DiscreteDistribution uniformDistribution(int lo, int hi);
+    friend DiscreteDistribution binomialDistribution(int n, double p, double tolerance);
+    friend DiscreteDistribution poissonDistribution(double lambda, double tolerance);
+    friend DiscreteDistribution geometricDistribution(double p, double tolerance);
+
+public:
+    const ProbabilitySpace<int>& probabilitySpace() const {
+        return space;
+    }
+
+    DistributionFamily distributionFamily() const {
+        return family;
+    }
+
+    /**
+     * @brief Calculate P(lo <= X <= hi) of the truncated distribution.
+     *
+     * A range in one tail is taken as the difference of two probabilities of that
+     * tail, so that it doesn't cancel against a probability close to one.
+     */
+    double probabilityOfRange(int lo, int hi) const {
+        long long from = std::max<long long>(lo, first);
+        long long to = std::min<long long>(hi, last);
+        if (to < from) return 0.0;
+        if (family == DistributionFamily::Uniform)
+            return static_cast<double>(to - from + 1) / static_cast<double>(last - first + 1);
+        double mass;
+        if (below(from) < 0.5) mass = below(to + 1) - below(from);
+        else mass = above(from - 1) - above(to);
+        if (std::isnan(mass)) return space.probabilityOfRange(lo, hi);
+        return std::min(1.0, std::max(0.0, mass / keptMass));
+    }
+
+    // P(X <= x) of the truncated distribution
+    double cumulativeProbability(int x) const {
+        if (x < first) return 0.0;
+        if (x >= last) return 1.0;
+        return probabilityOfRange(static_cast<int>(first), x);
+    }
+};
+
+/**
+ * @brief The uniform distribution over the integers lo, ..., hi.
+ *
+ * @throws std::invalid_argument if hi < lo.
+ */
+inline DiscreteDistribution uniformDistribution(int lo, int hi) {
+    if (hi < lo) throw std::invalid_argument("Uniform distribution needs lo <= hi");
+    std::size_t count = static_cast<std::size_t>(static_cast<long long>(hi) - lo + 1);
+    std::vector<int> keys(count);
+    for (std::size_t i = 0; i < count; ++i) keys[i] = static_cast<int>(lo + static_cast<long long>(i));
+    return DiscreteDistribution(DistributionFamily::Uniform, 0, 0.0, std::move(keys), std::vector<double>(count, 1.0));
+}
+
+/**
+ * @brief The binomial distribution of the number of successes in n trials with success probability p.
+ *
+ * @param tolerance Largest total probability of the tails left out of the table.
+ * @throws std::invalid_argument if n < 0, p is not in [0, 1], the tolerance is not in [0, 1)
+ * or the table would have more than MAX_DISTRIBUTION_TABLE outcomes.
+ */
+inline DiscreteDistribution binomialDistribution(int n, double p, double tolerance = 0.0) {
+    if (n < 0) throw std::invalid_argument("Binomial distribution needs n >= 0");
+    if (!(p >= 0.0 && p <= 1.0)) throw std::invalid_argument("Success probability must be in [0, 1]");
+    DiscreteDistribution::validTolerance(tolerance, false);
+    if (tolerance == 0.0 && p > 0.0 && p < 1.0) DiscreteDistribution::validTableLength(n + 1.0);
+    std::vector<int> keys;
+    std::vector<double> probs;
+    if (p == 0.0 || p == 1.0) {
+        keys.push_back(p == 0.0 ? 0 : n);
+        probs.push_back(1.0);
+    }
+    else {
+        long long mode = std::min<long long>(n, static_cast<long long>(std::floor((n + 1.0) * p)));
+        double pmfMode = std::exp(std::lgamma(n + 1.0) - std::lgamma(mode + 1.0) - std::lgamma(n - mode + 1.0) +
+                                  mode * std::log(p) + (n - mode) * std::log1p(-p));
+        double odds = p / (1.0 - p);
+        DiscreteDistribution::fromMode(mode, pmfMode, 0, n,
+            [&](long long k){ return static_cast<double>(n - k) / static_cast<double>(k + 1) * odds; },
+            [&](long long k){ return static_cast<double>(k) / static_cast<double>(n - k + 1) / odds; },
+            tolerance / 2, keys, probs);
+    }
+    return DiscreteDistribution(DistributionFamily::Binomial, n, p, std::move(keys), std::move(probs));
+}
+
+/**
+ * @brief The Poisson distribution with mean lambda.
+ *
+ * @param tolerance Largest total probability of the tails left out of the table.
+ * @throws std::invalid_argument if lambda is negative or too large for int outcomes,
+ * the tolerance is not in (0, 1) or the table would have more than
+ * MAX_DISTRIBUTION_TABLE outcomes.
+ */
+inline DiscreteDistribution poissonDistribution(double lambda, double tolerance = 1e-12) {
+    if (!(lambda >= 0.0 && lambda <= std::numeric_limits<int>::max() / 2))
+        throw std::invalid_argument("Poisson distribution needs a nonnegative mean within the range of int");
+    DiscreteDistribution::validTolerance(tolerance, true);
+    std::vector<int> keys;
+    std::vector<double> probs;
+    long long mode = static_cast<long long>(std::floor(lambda));
+    double pmfMode = lambda == 0.0 ? 1.0 : std::exp(mode * std::log(lambda) - lambda - std::lgamma(mode + 1.0));
+    DiscreteDistribution::fromMode(mode, pmfMode, 0, std::numeric_limits<int>::max(),
+        [&](long long k){ return lambda / static_cast<double>(k + 1); },
+        [&](long long k){ return static_cast<double>(k) / lambda; },
+        tolerance / 2, keys, probs);
+    return DiscreteDistribution(DistributionFamily::Poisson, 0, lambda, std::move(keys), std::move(probs));
+}
+
+/**
+ * @brief The geometric distribution of the number of trials up to the first success, k = 1, 2, ...
+ *
+ * @param tolerance Largest total probability of the tail left out of the table.
+ * @throws std::invalid_argument if p is not in (0, 1], the tolerance is not in (0, 1) or
+ * the table would have more than MAX_DISTRIBUTION_TABLE outcomes.
+ */
+inline DiscreteDistribution geometricDistribution(double p, double tolerance = 1e-12) {
+    if (!(p > 0.0 && p <= 1.0)) throw std::invalid_argument("Success probability must be in (0, 1]");
+    DiscreteDistribution::validTolerance(tolerance, true);
+    // The table ends at the first k with (1 - p)^(k + 1) <= tolerance / 2
+    if (p < 1.0) DiscreteDistribution::validTableLength(std::log(tolerance / 2) / std::log1p(-p));
+    std::vector<int> keys;
+    std::vector<double> probs;
+    DiscreteDistribution::fromMode(1, p, 1, std::numeric_limits<int>::max(),
+        [&](long long){ return 1.0 - p; },
+        [&](long long){ return 0.0; },
+        tolerance / 2, keys, probs);
+    return DiscreteDistribution(DistributionFamily::Geometric, 0, p, std::move(keys), std::move(probs));
+}
+
+#endif
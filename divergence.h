@@ -0,0 +1,233 @@
+#ifndef DIVERGENCE_H
+#define DIVERGENCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "executor.h"
+#include "probability_space.h"
+#include "summation.h"
+
+
+/**
+ * @brief What a comparison of two spaces does with an outcome only one of them has.
+ *
+ * Throw rejects spaces with different sample spaces. AsZero treats an outcome missing
+ * from a space as an outcome of probability 0 there, so e.g. the KL divergence of P
+ * from Q is infinite when P has an outcome Q lacks. The overloads without a policy
+ * use AsZero only if both spaces skip unknown outcomes, the rule of event queries.
+ */
+enum class MissingOutcomes { Throw, AsZero };
+
+/**
+ * @brief Divergences and distances between two distributions P and Q, in nats.
+ *
+ * klDivergence is KL(P || Q) and reverseKlDivergence is KL(Q || P). The others are
+ * symmetric: jsDivergence is the Jensen-Shannon divergence, totalVariation is half
+ * the L1 distance and hellinger the Hellinger distance, so both lie in [0, 1].
+ */
+struct DistributionDistances {
+    double klDivergence = 0.0;
+    double reverseKlDivergence = 0.0;
+    double jsDivergence = 0.0;
+    double totalVariation = 0.0;
+    double hellinger = 0.0;
+};
+
+// p log(p/q) with the conventions 0 log(0/q) = 0 and p log(p/0) = infinity
+inline double relativeEntropyTerm(double p, double q) {
+    if (p == 0.0) return 0.0;
+    if (q == 0.0) return std::numeric_limits<double>::infinity();
+    return p * std::log(p / q);
+}
+
+// The five sums of DistributionDistances, fed one pair of probabilities per outcome
+template <typename Sum>
+struct DistanceSums {
+    BlockedSum<Sum> kl, reverseKl, js, variation, hellinger;
+
+    void add(double p, double q) {
+        double m = 0.5 * (p + q);
+        double root = std::sqrt(p) - std::sqrt(q);
+        kl.add(relativeEntropyTerm(p, q));
+        reverseKl.add(relativeEntropyTerm(q, p));
+        js.add(0.5 * (relativeEntropyTerm(p, m) + relativeEntropyTerm(q, m)));
+        variation.add(std::abs(p - q));
+        hellinger.add(root * root);
+    }
+
+    DistributionDistances result() const {
+        DistributionDistances d;
+        d.klDivergence = kl.result();
+        d.reverseKlDivergence = reverseKl.result();
+        d.jsDivergence = js.result();
+        d.totalVariation = 0.5 * variation.result();
+        d.hellinger = std::sqrt(0.5 * hellinger.result());
+        return d;
+    }
+};
+
+/*
+ * Visit the probabilities of every outcome of P or Q as visit(p, q). Spaces with the
+ * same outcomes, either shared storage or equal arrays, are walked index by index in
+ * a loop without comparisons; otherwise a merge-join walks both sorted storages once.
+ */
+template <typename T, typename Sum, typename Visit>
+void joinWalk(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ,
+              MissingOutcomes missing, Visit&& visit) {
+    const T* outP = spaceP.outcomeData();
+    const T* outQ = spaceQ.outcomeData();
+    const double* probP = spaceP.probabilityData();
+    const double* probQ = spaceQ.probabilityData();
+    std::size_t n = spaceP.size(), m = spaceQ.size();
+    if (n == m && (outP == outQ || std::equal(outP, outP + n, outQ))) {
+        for (std::size_t i = 0; i < n; ++i) visit(probP[i], probQ[i]);
+        return;
+    }
+    if (missing == MissingOutcomes::Throw) throw std::invalid_argument("Spaces have different outcomes");
+    std::size_t i = 0, j = 0;
+    while (i < n && j < m) {
+        if (outP[i] < outQ[j]) visit(probP[i++], 0.0);
+        else if (outQ[j] < outP[i]) visit(0.0, probQ[j++]);
+        else visit(probP[i++], probQ[j++]);
+    }
+    for (; i < n; ++i) visit(probP[i], 0.0);
+    for (; j < m; ++j) visit(0.0, probQ[j]);
+}
+
+template <typename T, typename Sum>
+MissingOutcomes missingOutcomesOf(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ) {
+    return spaceP.getCurrentMode() && spaceQ.getCurrentMode() ? MissingOutcomes::AsZero : MissingOutcomes::Throw;
+}
+
+/**
+ * @brief Calculate the entropy H(P) = -sum p log p of a space, in nats.
+ */
+template <typename T, typename Sum>
+double entropy(const ProbabilitySpace<T, Sum>& space) {
+    const double* probs = space.probabilityData();
+    BlockedSum<Sum> total;
+    for (std::size_t i = 0; i < space.size(); ++i) total.add(probs[i] > 0.0 ? -probs[i] * std::log(probs[i]) : 0.0);
+    return total.result();
+}
+
+/**
+ * @brief Calculate all divergences and distances between P and Q in one walk.
+ *
+ * @throws std::invalid_argument if the sample spaces differ and missing is Throw.
+ */
+template <typename T, typename Sum>
+DistributionDistances distances(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ,
+                                MissingOutcomes missing) {
+    DistanceSums<Sum> sums;
+    joinWalk(spaceP, spaceQ, missing, [&](double p, double q) { sums.add(p, q); });
+    return sums.result();
+}
+
+template <typename T, typename Sum>
+DistributionDistances distances(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ) {
+    return distances(spaceP, spaceQ, missingOutcomesOf(spaceP, spaceQ));
+}
+
+/**
+ * @brief Calculate KL(P || Q), infinite if P has an outcome of probability 0 in Q.
+ *
+ * @throws std::invalid_argument if the sample spaces differ and missing is Throw.
+ */
+template <typename T, typename Sum>
+double klDivergence(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ,
+                    MissingOutcomes missing) {
+    BlockedSum<Sum> total;
+    joinWalk(spaceP, spaceQ, missing, [&](double p, double q) { total.add(relativeEntropyTerm(p, q)); });
+    return total.result();
+}
+
+template <typename T, typename Sum>
+double klDivergence(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ) {
+    return klDivergence(spaceP, spaceQ, missingOutcomesOf(spaceP, spaceQ));
+}
+
+// Jensen-Shannon divergence, at most log 2
+template <typename T, typename Sum>
+double jsDivergence(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ,
+                    MissingOutcomes missing) {
+    BlockedSum<Sum> total;
+    joinWalk(spaceP, spaceQ, missing, [&](double p, double q) {
+        double m = 0.5 * (p + q);
+        total.add(0.5 * (relativeEntropyTerm(p, m) + relativeEntropyTerm(q, m)));
+    });
+    return total.result();
+}
+
+template <typename T, typename Sum>
+double jsDivergence(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ) {
+    return jsDivergence(spaceP, spaceQ, missingOutcomesOf(spaceP, spaceQ));
+}
+
+// Total variation distance: the largest difference of the probabilities of an event
+template <typename T, typename Sum>
+double totalVariationDistance(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ,
+                              MissingOutcomes missing) {
+    BlockedSum<Sum> total;
+    joinWalk(spaceP, spaceQ, missing, [&](double p, double q) { total.add(std::abs(p - q)); });
+    return 0.5 * total.result();
+}
+
+template <typename T, typename Sum>
+double totalVariationDistance(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ) {
+    return totalVariationDistance(spaceP, spaceQ, missingOutcomesOf(spaceP, spaceQ));
+}
+
+// Hellinger distance sqrt(sum (sqrt p - sqrt q)^2 / 2)
+template <typename T, typename Sum>
+double hellingerDistance(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ,
+                         MissingOutcomes missing) {
+    BlockedSum<Sum> total;
+    joinWalk(spaceP, spaceQ, missing, [&](double p, double q) {
+        double root = std::sqrt(p) - std::sqrt(q);
+        total.add(root * root);
+    });
+    return std::sqrt(0.5 * total.result());
+}
+
+template <typename T, typename Sum>
+double hellingerDistance(const ProbabilitySpace<T, Sum>& spaceP, const ProbabilitySpace<T, Sum>& spaceQ) {
+    return hellingerDistance(spaceP, spaceQ, missingOutcomesOf(spaceP, spaceQ));
+}
+
+/**
+ * @brief Compare every pair of spaces, spread over the threads of an executor.
+ *
+ * Each unordered pair is walked once; the walk gives the KL divergences in both
+ * directions. Every entry is computed by one thread in a fixed order, so the
+ * results don't depend on the number of threads.
+ *
+ * @return n * n entries, where entry i * n + j compares spaces[i] as P to spaces[j]
+ * as Q. The diagonal is all zeros.
+ * @throws std::invalid_argument if two sample spaces differ and missing is Throw.
+ */
+template <typename T, typename Sum>
+std::vector<DistributionDistances> pairwiseDistances(const std::vector<ProbabilitySpace<T, Sum>>& spaces,
+                                                     MissingOutcomes missing, WorkStealingExecutor& executor) {
+    std::size_t n = spaces.size();
+    std::vector<DistributionDistances> result(n * n);
+    // Row i holds the pairs (i, j > i), so rows get shorter; chunks of one row let
+    // the executor balance them
+    executor.forEachChunk(n, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            for (std::size_t j = i + 1; j < n; ++j) {
+                DistributionDistances d = distances(spaces[i], spaces[j], missing);
+                result[i * n + j] = d;
+                std::swap(d.klDivergence, d.reverseKlDivergence);
+                result[j * n + i] = d;
+            }
+        }
+    });
+    return result;
+}
+
+#endif
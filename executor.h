@@ -0,0 +1,193 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+
+/**
+ * @brief A fixed pool of threads that runs chunked loops with work stealing.
+ *
+ * Every call to forEachChunk() splits the iteration space into chunks and hands
+ * each participating thread a contiguous share of them. A thread that runs out of
+ * chunks steals the remaining chunks of the others, so uneven chunk costs don't
+ * leave threads idle. Claiming a chunk is a single atomic increment; there are no
+ * locks on the hot path. The calling thread takes part in the work.
+ *
+ * A body may call forEachChunk() on the executor that runs it, e.g. a parallel
+ * query inside a parallel batch. The nested loop then runs inline on the calling
+ * thread, chunk by chunk, since the threads of the pool are busy with the outer loop.
+ */
+class WorkStealingExecutor {
+private:
+    // One share of chunks. Owner and thieves claim chunks from the same counter,
+    // padded so that the counters of different threads don't share a cache line.
+    struct alignas(64) Share {
+        std::atomic<std::size_t> next{0};
+        std::size_t end = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Share[]> shares;
+    std::size_t participants;
+
+    std::mutex runMutex;
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::size_t generation = 0;
+    std::size_t active = 0;
+    bool stopping = false;
+
+    std::function<void(std::size_t)> job;
+    std::exception_ptr failure;
+
+    // The executors whose chunks the current thread is running, innermost first
+    struct RunningScope {
+        const WorkStealingExecutor* executor;
+        RunningScope* outer;
+    };
+
+    static RunningScope*& runningScopes() {
+        thread_local RunningScope* innermost = nullptr;
+        return innermost;
+    }
+
+    bool runsOnCurrentThread() const {
+        for (RunningScope* scope = runningScopes(); scope; scope = scope->outer) {
+            if (scope->executor == this) return true;
+        }
+        return false;
+    }
+
+    void runChunk(std::size_t chunk) {
+        RunningScope scope{this, runningScopes()};
+        runningScopes() = &scope;
+        try {
+            job(chunk);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (!failure) failure = std::current_exception();
+        }
+        runningScopes() = scope.outer;
+    }
+
+    // Drain the own share first, then steal from the others in turn.
+    void participate(std::size_t self) {
+        for (std::size_t k = 0; k < participants; ++k) {
+            Share& share = shares[(self + k) % participants];
+            for (std::size_t chunk = share.next.fetch_add(1); chunk < share.end;
+                 chunk = share.next.fetch_add(1)) {
+                runChunk(chunk);
+            }
+        }
+    }
+
+    void workerLoop(std::size_t self) {
+        std::size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                wake.wait(lock, [&]{ return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            participate(self);
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (--active == 0) done.notify_one();
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Start the pool.
+     *
+     * @param threads Total number of threads taking part in each loop, including the
+     * calling thread. Zero uses one thread per hardware thread.
+     */
+    explicit WorkStealingExecutor(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        participants = threads;
+        shares.reset(new Share[participants]);
+        for (std::size_t i = 1; i < participants; ++i) {
+            workers.emplace_back([this, i]{ workerLoop(i); });
+        }
+    }
+
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+    ~WorkStealingExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    std::size_t threadCount() const { return participants; }
+
+    /**
+     * @brief Run body(begin, end) over [0, count) split into chunks of chunkSize.
+     *
+     * Returns once every chunk has run. Calls from different threads are serialized;
+     * a call from inside a body of this executor runs inline.
+     *
+     * @param count Number of iterations.
+     * @param chunkSize Number of iterations per chunk, 0 picks a size that gives every
+     * thread several chunks to balance.
+     * @param body Callable taking the half-open range [begin, end) of one chunk.
+     * @throws The first exception thrown by body, after all chunks have finished.
+     */
+    template <typename Body>
+    void forEachChunk(std::size_t count, std::size_t chunkSize, Body body) {
+        if (count == 0) return;
+        if (chunkSize == 0) chunkSize = std::max<std::size_t>(1, count / (participants * 8));
+        std::size_t chunks = (count + chunkSize - 1) / chunkSize;
+
+        if (runsOnCurrentThread()) {
+            for (std::size_t begin = 0; begin < count; begin += chunkSize) body(begin, std::min(count, begin + chunkSize));
+            return;
+        }
+
+        std::lock_guard<std::mutex> run(runMutex);
+        for (std::size_t p = 0; p < participants; ++p) {
+            shares[p].next.store(p * chunks / participants, std::memory_order_relaxed);
+            shares[p].end = (p + 1) * chunks / participants;
+        }
+        job = [&](std::size_t chunk) {
+            std::size_t begin = chunk * chunkSize;
+            body(begin, std::min(count, begin + chunkSize));
+        };
+        failure = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            active = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        participate(0);
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            done.wait(lock, [&]{ return active == 0; });
+        }
+
+        job = nullptr;
+        if (failure) std::rethrow_exception(failure);
+    }
+};
+
+#endif
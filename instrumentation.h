@@ -0,0 +1,321 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Query instrumentation of ProbabilitySpace.
+ *
+ * Compiled in only when PROBABILITY_ENGINE_INSTRUMENTATION is defined before the
+ * first include of probability_space.h. Otherwise the hooks in the queries expand
+ * to nothing and cost nothing; the snapshot API below stays available and reports
+ * zeros, so code exporting the statistics builds either way.
+ *
+ * Every thread counts into its own accumulators, which only the owning thread
+ * writes, so the hot path needs no atomic read-modify-write and no locks.
+ * instrumentationSnapshot() merges the accumulators of all live threads with the
+ * totals left behind by threads that have exited.
+ *
+ * Counting is best-effort and never throws, since the hooks run inside the noexcept
+ * try* queries: if a thread's counters can't be registered, e.g. because the registry
+ * runs out of memory, that thread keeps counting into accumulators no snapshot sees.
+ */
+
+#ifdef PROBABILITY_ENGINE_INSTRUMENTATION
+constexpr bool INSTRUMENTATION_ENABLED = true;
+#else
+constexpr bool INSTRUMENTATION_ENABLED = false;
+#endif
+
+// The instrumented query kinds
+enum class QueryOperation : std::size_t { Probability, Complement, Union, Intersection, Conditional };
+
+constexpr std::size_t QUERY_OPERATIONS = 5;
+
+// Histogram bucket k counts values in [2^(k-1), 2^k), bucket 0 counts zeros and
+// the last bucket everything beyond.
+constexpr std::size_t HISTOGRAM_BUCKETS = 40;
+
+inline std::size_t histogramBucket(std::uint64_t value) {
+    if (value == 0) return 0;
+    std::size_t bucket = 64 - static_cast<std::size_t>(__builtin_clzll(value));
+    return std::min(bucket, HISTOGRAM_BUCKETS - 1);
+}
+
+inline const char* operationName(QueryOperation operation) {
+    static const char* const names[QUERY_OPERATIONS] = {"probability", "complement", "union", "intersection",
+                                                        "conditional"};
+    return names[static_cast<std::size_t>(operation)];
+}
+
+// Merged statistics of all threads
+struct InstrumentationSnapshot {
+    std::array<std::uint64_t, QUERY_OPERATIONS> calls{};
+    std::array<std::uint64_t, QUERY_OPERATIONS> latencySumNs{};
+    // Latencies in nanoseconds, per operation
+    std::array<std::array<std::uint64_t, HISTOGRAM_BUCKETS>, QUERY_OPERATIONS> latency{};
+    // Number of outcomes of every event passed to a query
+    std::array<std::uint64_t, HISTOGRAM_BUCKETS> eventSizes{};
+    std::uint64_t eventSizeSum = 0;
+    // Queries rejected for unknown outcomes or a condition of probability 0
+    std::uint64_t validationFailures = 0;
+    // Bytes of storage allocated for spaces, validated events and views
+    std::uint64_t bytesAllocated = 0;
+};
+
+// Counters of one thread. Only the owner writes them, with relaxed load and store
+// pairs; the atomics only make concurrent snapshots well defined.
+class ThreadCounters {
+private:
+    using Counter = std::atomic<std::uint64_t>;
+
+    std::array<Counter, QUERY_OPERATIONS> calls{};
+    std::array<Counter, QUERY_OPERATIONS> latencySumNs{};
+    std::array<std::array<Counter, HISTOGRAM_BUCKETS>, QUERY_OPERATIONS> latency{};
+    std::array<Counter, HISTOGRAM_BUCKETS> eventSizes{};
+    Counter eventSizeSum{0};
+    Counter validationFailures{0};
+    Counter bytesAllocated{0};
+    bool registered = false;
+
+    static void bump(Counter& counter, std::uint64_t amount = 1) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static std::uint64_t read(const Counter& counter) {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+public:
+    ThreadCounters() noexcept;
+    ~ThreadCounters();
+
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+
+    void addQuery(QueryOperation operation, std::uint64_t nanoseconds) noexcept {
+        std::size_t op = static_cast<std::size_t>(operation);
+        bump(calls[op]);
+        bump(latencySumNs[op], nanoseconds);
+        bump(latency[op][histogramBucket(nanoseconds)]);
+    }
+
+    void addEventSize(std::size_t size) noexcept {
+        bump(eventSizes[histogramBucket(size)]);
+        bump(eventSizeSum, size);
+    }
+
+    void addFailure() noexcept { bump(validationFailures); }
+
+    void addBytes(std::size_t bytes) noexcept { bump(bytesAllocated, bytes); }
+
+    void mergeInto(InstrumentationSnapshot& snapshot) const {
+        for (std::size_t op = 0; op < QUERY_OPERATIONS; ++op) {
+            snapshot.calls[op] += read(calls[op]);
+            snapshot.latencySumNs[op] += read(latencySumNs[op]);
+            for (std::size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) snapshot.latency[op][b] += read(latency[op][b]);
+        }
+        for (std::size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) snapshot.eventSizes[b] += read(eventSizes[b]);
+        snapshot.eventSizeSum += read(eventSizeSum);
+        snapshot.validationFailures += read(validationFailures);
+        snapshot.bytesAllocated += read(bytesAllocated);
+    }
+
+    // Not synchronized with the owner; counts racing with a reset may survive it.
+    void reset() {
+        for (std::size_t op = 0; op < QUERY_OPERATIONS; ++op) {
+            calls[op].store(0, std::memory_order_relaxed);
+            latencySumNs[op].store(0, std::memory_order_relaxed);
+            for (auto& bucket : latency[op]) bucket.store(0, std::memory_order_relaxed);
+        }
+        for (auto& bucket : eventSizes) bucket.store(0, std::memory_order_relaxed);
+        eventSizeSum.store(0, std::memory_order_relaxed);
+        validationFailures.store(0, std::memory_order_relaxed);
+        bytesAllocated.store(0, std::memory_order_relaxed);
+    }
+};
+
+// All live thread counters and the totals of exited threads
+class InstrumentationRegistry {
+private:
+    std::mutex mutex;
+    std::vector<ThreadCounters*> live;
+    InstrumentationSnapshot retired;
+
+public:
+    static InstrumentationRegistry& instance() {
+        static InstrumentationRegistry registry;
+        return registry;
+    }
+
+    void attach(ThreadCounters* counters) {
+        std::lock_guard<std::mutex> lock(mutex);
+        live.push_back(counters);
+    }
+
+    void detach(ThreadCounters* counters) {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters->mergeInto(retired);
+        live.erase(std::remove(live.begin(), live.end(), counters), live.end());
+    }
+
+    InstrumentationSnapshot snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        InstrumentationSnapshot result = retired;
+        for (auto counters : live) counters->mergeInto(result);
+        return result;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired = InstrumentationSnapshot();
+        for (auto counters : live) counters->reset();
+    }
+};
+
+inline ThreadCounters::ThreadCounters() noexcept {
+    try {
+        InstrumentationRegistry::instance().attach(this);
+        registered = true;
+    }
+    catch (...) {
+    }
+}
+
+inline ThreadCounters::~ThreadCounters() {
+    if (!registered) return;
+    try {
+        InstrumentationRegistry::instance().detach(this);
+    }
+    catch (...) {
+    }
+}
+
+// The counters of the calling thread, registered on first use
+inline ThreadCounters& threadCounters() noexcept {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+// Records the latency of one query when it goes out of scope. Never throws.
+class QueryTimer {
+private:
+    QueryOperation operation;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    QueryTimer(QueryOperation operation, std::initializer_list<std::size_t> eventSizes) noexcept
+        : operation(operation) {
+        ThreadCounters& counters = threadCounters();
+        for (auto size : eventSizes) counters.addEventSize(size);
+        start = std::chrono::steady_clock::now();
+    }
+
+    QueryTimer(const QueryTimer&) = delete;
+    QueryTimer& operator=(const QueryTimer&) = delete;
+
+    ~QueryTimer() noexcept {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        threadCounters().addQuery(operation, static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+};
+
+#ifdef PROBABILITY_ENGINE_INSTRUMENTATION
+#define PROBABILITY_ENGINE_TIME_QUERY(operation, ...) \
+    QueryTimer probabilityEngineQueryTimer(QueryOperation::operation, {__VA_ARGS__})
+#define PROBABILITY_ENGINE_COUNT_FAILURE() threadCounters().addFailure()
+#define PROBABILITY_ENGINE_COUNT_BYTES(bytes) threadCounters().addBytes(bytes)
+#else
+#define PROBABILITY_ENGINE_TIME_QUERY(operation, ...) ((void)0)
+#define PROBABILITY_ENGINE_COUNT_FAILURE() ((void)0)
+#define PROBABILITY_ENGINE_COUNT_BYTES(bytes) ((void)0)
+#endif
+
+/**
+ * @brief Merge the statistics of all threads.
+ *
+ * Counters of threads still running are read while they may change, so a
+ * snapshot is exact per counter but not across counters.
+ */
+inline InstrumentationSnapshot instrumentationSnapshot() {
+    return InstrumentationRegistry::instance().snapshot();
+}
+
+// Zero all statistics, e.g. between measurement windows.
+inline void resetInstrumentation() {
+    InstrumentationRegistry::instance().reset();
+}
+
+// A sink receives snapshots, e.g. to forward them to a metrics system.
+using InstrumentationSink = std::function<void(const InstrumentationSnapshot&)>;
+
+inline void publishInstrumentation(const InstrumentationSink& sink) {
+    sink(instrumentationSnapshot());
+}
+
+/**
+ * @brief Render a snapshot in the Prometheus text exposition format.
+ *
+ * Latencies are exported in seconds. Histogram buckets are cumulative, as
+ * Prometheus expects, with the upper bounds of the power-of-two buckets.
+ */
+inline std::string prometheusText(const InstrumentationSnapshot& snapshot) {
+    std::string text;
+    auto number = [](double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+        return std::string(buffer);
+    };
+    auto line = [&](const std::string& name, const std::string& labels, double value) {
+        text += name + (labels.empty() ? "" : "{" + labels + "}") + " " + number(value) + "\n";
+    };
+    // Upper bound of a bucket, scaled from the integer bucket bounds
+    auto bound = [&](std::size_t bucket, double scale) {
+        if (bucket + 1 == HISTOGRAM_BUCKETS) return std::string("+Inf");
+        return number(scale * double(bucket == 0 ? 0 : (std::uint64_t{1} << bucket) - 1));
+    };
+
+    text += "# TYPE probability_engine_query_latency_seconds histogram\n";
+    for (std::size_t op = 0; op < QUERY_OPERATIONS; ++op) {
+        std::string label = std::string("operation=\"") + operationName(QueryOperation(op)) + "\"";
+        std::uint64_t cumulative = 0;
+        for (std::size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+            cumulative += snapshot.latency[op][b];
+            line("probability_engine_query_latency_seconds_bucket", label + ",le=\"" + bound(b, 1e-9) + "\"",
+                 double(cumulative));
+        }
+        line("probability_engine_query_latency_seconds_sum", label, double(snapshot.latencySumNs[op]) * 1e-9);
+        line("probability_engine_query_latency_seconds_count", label, double(snapshot.calls[op]));
+    }
+
+    text += "# TYPE probability_engine_event_size histogram\n";
+    std::uint64_t cumulative = 0;
+    std::uint64_t events = 0;
+    for (std::size_t b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        cumulative += snapshot.eventSizes[b];
+        events += snapshot.eventSizes[b];
+        line("probability_engine_event_size_bucket", "le=\"" + bound(b, 1.0) + "\"", double(cumulative));
+    }
+    line("probability_engine_event_size_sum", "", double(snapshot.eventSizeSum));
+    line("probability_engine_event_size_count", "", double(events));
+
+    text += "# TYPE probability_engine_validation_failures_total counter\n";
+    line("probability_engine_validation_failures_total", "", double(snapshot.validationFailures));
+    text += "# TYPE probability_engine_allocated_bytes_total counter\n";
+    line("probability_engine_allocated_bytes_total", "", double(snapshot.bytesAllocated));
+    return text;
+}
+
+#endif
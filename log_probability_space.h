@@ -0,0 +1,296 @@
+#ifndef LOG_PROBABILITY_SPACE_H
+#define LOG_PROBABILITY_SPACE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "probability_space.h"
+#include "scratch_arena.h"
+
+
+/**
+ * @brief Calculate log(sum exp(values[i])) over [0, size) without overflow or underflow.
+ *
+ * The terms are shifted by their maximum, so the largest one is exp(0) = 1 and
+ * terms far below the smallest double still count relative to it. Both passes use
+ * four independent accumulators, added up in a fixed order.
+ *
+ * @return The log of the sum, -infinity for no terms or only -infinity terms.
+ */
+inline double logSumExp(const double* values, std::size_t size) {
+    constexpr double NONE = -std::numeric_limits<double>::infinity();
+    double highs[4] = {NONE, NONE, NONE, NONE};
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        highs[0] = std::max(highs[0], values[i]);
+        highs[1] = std::max(highs[1], values[i + 1]);
+        highs[2] = std::max(highs[2], values[i + 2]);
+        highs[3] = std::max(highs[3], values[i + 3]);
+    }
+    for (; i < size; ++i) highs[0] = std::max(highs[0], values[i]);
+    double high = std::max(std::max(highs[0], highs[1]), std::max(highs[2], highs[3]));
+    if (high == NONE) return NONE;
+
+    double lanes[4] = {0.0, 0.0, 0.0, 0.0};
+    i = 0;
+    for (; i + 4 <= size; i += 4) {
+        lanes[0] += std::exp(values[i] - high);
+        lanes[1] += std::exp(values[i + 1] - high);
+        lanes[2] += std::exp(values[i + 2] - high);
+        lanes[3] += std::exp(values[i + 3] - high);
+    }
+    for (; i < size; ++i) lanes[0] += std::exp(values[i] - high);
+    return high + std::log((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]));
+}
+
+/**
+ * @brief A probability space storing the logarithms of its probabilities.
+ *
+ * For sample spaces whose probabilities go below the range of a double, or lose
+ * their precision in a running sum next to much larger ones. Event probabilities
+ * are calculated as log-sum-exp reductions of the log-probabilities of their
+ * outcomes, which are gathered into the scratch arena of the thread first, so the
+ * reduction runs over a contiguous buffer. Results are log-probabilities; -infinity
+ * is the log of 0.
+ *
+ * The outcomes are stored sorted and dense like in ProbabilitySpace, and unknown
+ * outcomes are handled the same way.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class LogProbabilitySpace {
+private:
+    std::vector<T> outcomes;
+    std::vector<double> logProbabilities;
+    bool ignoreUnknown = false;
+
+    static constexpr double LOG_ZERO = -std::numeric_limits<double>::infinity();
+
+    void validLogProbabilities() const {
+        for (double lp : logProbabilities) {
+            if (std::isnan(lp) || lp > 0.0) throw std::invalid_argument("Log-probabilities must be at most 0");
+        }
+        double total = logSumExp(logProbabilities.data(), logProbabilities.size());
+        // log(1 + d) is about d, so the log of the total is its relative error
+        if (!(std::abs(total) <= sumTolerance(logProbabilities.size())))
+            throw std::invalid_argument("Probabilities must sum to 1");
+    }
+
+    // Position of an outcome of a sorted walk, searching on from pos
+    bool locate(const T& outcome, std::size_t& pos) const {
+        pos = static_cast<std::size_t>(std::lower_bound(outcomes.begin() + pos, outcomes.end(), outcome) - outcomes.begin());
+        return pos < outcomes.size() && !(outcome < outcomes[pos]);
+    }
+
+    // Append the log-probabilities of the outcomes of an event to a buffer
+    void gather(const std::set<T>& event, std::pmr::vector<double>& logs) const {
+        std::size_t pos = 0;
+        for (const auto& outcome : event) {
+            if (locate(outcome, pos)) logs.push_back(logProbabilities[pos]);
+            else if (!ignoreUnknown) throw std::invalid_argument("Event contains outcome not in sample space");
+        }
+    }
+
+    // Walk A and B together, gathering the outcomes in both, in either or in B
+    template <typename Keep>
+    double mergedLog(const std::set<T>& eventA, const std::set<T>& eventB, Keep keep) const {
+        ScratchScope scratch;
+        std::pmr::vector<double> logs(scratch.resource());
+        logs.reserve(eventA.size() + eventB.size());
+        auto a = eventA.begin();
+        auto b = eventB.begin();
+        std::size_t pos = 0;
+        while (a != eventA.end() || b != eventB.end()) {
+            bool inA = b == eventB.end() || (a != eventA.end() && !(*b < *a));
+            bool inB = a == eventA.end() || (b != eventB.end() && !(*a < *b));
+            const T& outcome = inA ? *a : *b;
+            if (locate(outcome, pos)) {
+                if (keep(inA, inB)) logs.push_back(logProbabilities[pos]);
+            }
+            else if (!ignoreUnknown) {
+                throw std::invalid_argument("Event contains outcome not in sample space");
+            }
+            if (inA) ++a;
+            if (inB) ++b;
+        }
+        return logSumExp(logs.data(), logs.size());
+    }
+
+public:
+    /**
+     * @brief Construct a space from a mapping of outcomes to their log-probabilities.
+     *
+     * @throws std::invalid_argument if a log-probability is above 0 or the probabilities
+     * don't sum to one within sumTolerance() of the number of outcomes.
+     */
+    explicit LogProbabilitySpace(std::map<T, double> logMapping) {
+        outcomes.reserve(logMapping.size());
+        logProbabilities.reserve(logMapping.size());
+        while (!logMapping.empty()) {
+            auto node = logMapping.extract(logMapping.begin());
+            outcomes.push_back(std::move(node.key()));
+            logProbabilities.push_back(node.mapped());
+        }
+        validLogProbabilities();
+    }
+
+    /**
+     * @brief Construct a space from parallel arrays of outcomes and log-probabilities.
+     *
+     * @param keys Outcomes sorted in ascending order without duplicates.
+     * @param logs logs[i] is the log-probability of keys[i].
+     * @throws std::invalid_argument if the arrays differ in size, the outcomes are not
+     * sorted and unique or the log-probabilities are not a distribution.
+     */
+    LogProbabilitySpace(SortedUniqueTag, std::vector<T> keys, std::vector<double> logs)
+        : outcomes(std::move(keys)), logProbabilities(std::move(logs)) {
+        if (outcomes.size() != logProbabilities.size())
+            throw std::invalid_argument("Every outcome needs exactly one probability");
+        if (std::adjacent_find(outcomes.begin(), outcomes.end(), [](const T& a, const T& b){ return !(a < b); }) != outcomes.end())
+            throw std::invalid_argument("Outcomes must be sorted and unique");
+        validLogProbabilities();
+    }
+
+    // Take the logarithms of the probabilities of a space
+    explicit LogProbabilitySpace(const ProbabilitySpace<T>& space) {
+        outcomes.reserve(space.size());
+        logProbabilities.reserve(space.size());
+        for (std::size_t i = 0; i < space.size(); ++i) {
+            outcomes.push_back(space.outcomeAt(i));
+            logProbabilities.push_back(std::log(space.probabilityAt(i)));
+        }
+        ignoreUnknown = space.getCurrentMode();
+    }
+
+    // log P(E)
+    double logProbabilityOfSet(const std::set<T>& event) const {
+        ScratchScope scratch;
+        std::pmr::vector<double> logs(scratch.resource());
+        logs.reserve(event.size());
+        gather(event, logs);
+        return logSumExp(logs.data(), logs.size());
+    }
+
+    // log P(E^c), summed over the outcomes outside E so that it stays exact when P(E) is close to 1
+    double logComplementOfEvent(const std::set<T>& event) const {
+        ScratchScope scratch;
+        std::pmr::vector<double> logs(scratch.resource());
+        logs.reserve(outcomes.size());
+        std::size_t pos = 0;
+        auto outcome = event.begin();
+        for (; outcome != event.end(); ++outcome) {
+            std::size_t from = pos;
+            bool found = locate(*outcome, pos);
+            if (!found && !ignoreUnknown) throw std::invalid_argument("Event contains outcome not in sample space");
+            logs.insert(logs.end(), logProbabilities.begin() + from, logProbabilities.begin() + pos);
+            if (found) ++pos;
+        }
+        logs.insert(logs.end(), logProbabilities.begin() + pos, logProbabilities.end());
+        return logSumExp(logs.data(), logs.size());
+    }
+
+    // log P(A u B)
+    double logUnionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        return mergedLog(eventA, eventB, [](bool, bool){ return true; });
+    }
+
+    // log P(A n B)
+    double logIntersectionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        return mergedLog(eventA, eventB, [](bool inA, bool inB){ return inA && inB; });
+    }
+
+    /**
+     * @brief Calculate log P(A|B).
+     *
+     * @throws std::invalid_argument if an event contains an outcome not in the sample
+     * space, or P(B)=0.
+     */
+    double logConditionalProbability(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        double logB = logProbabilityOfSet(eventB);
+        if (logB == LOG_ZERO)
+            throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
+        return logIntersectionOfEvents(eventA, eventB) - logB;
+    }
+
+    // log P(lo <= X <= hi), reduced over the contiguous run of outcomes without gathering
+    double logProbabilityOfRange(const T& lo, const T& hi) const {
+        if (hi < lo) return LOG_ZERO;
+        auto first = std::lower_bound(outcomes.begin(), outcomes.end(), lo) - outcomes.begin();
+        auto last = std::upper_bound(outcomes.begin(), outcomes.end(), hi) - outcomes.begin();
+        return logSumExp(logProbabilities.data() + first, static_cast<std::size_t>(last - first));
+    }
+
+    // P(E), which underflows to 0 where log P(E) is below the range of a double
+    double probabilityOfSet(const std::set<T>& event) const {
+        return std::exp(logProbabilityOfSet(event));
+    }
+
+    /**
+     * @brief Condition the space on an event B, staying in log-space.
+     *
+     * Repeated conditioning keeps the probabilities as logs, so they never underflow
+     * no matter how small P(B) gets.
+     *
+     * @return The space of the outcomes of B with log P(x|B) = log P(x) - log P(B).
+     * @throws std::invalid_argument if B contains an outcome not in the sample space or P(B)=0.
+     */
+    LogProbabilitySpace conditionOn(const std::set<T>& eventB) const {
+        std::vector<T> keys;
+        std::vector<double> logs;
+        std::size_t pos = 0;
+        for (const auto& outcome : eventB) {
+            if (locate(outcome, pos)) {
+                keys.push_back(outcome);
+                logs.push_back(logProbabilities[pos]);
+            }
+            else if (!ignoreUnknown) {
+                throw std::invalid_argument("Event contains outcome not in sample space");
+            }
+        }
+        double logB = logSumExp(logs.data(), logs.size());
+        if (logB == LOG_ZERO)
+            throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
+        for (double& lp : logs) lp -= logB;
+        LogProbabilitySpace result(std::move(keys), std::move(logs));
+        result.ignoreUnknown = ignoreUnknown;
+        return result;
+    }
+
+    // Number of outcomes in the sample space
+    std::size_t size() const {
+        return outcomes.size();
+    }
+
+    // Outcomes in ascending order and their log-probabilities, index by index
+    const T& outcomeAt(std::size_t index) const {
+        return outcomes[index];
+    }
+
+    double logProbabilityAt(std::size_t index) const {
+        return logProbabilities[index];
+    }
+
+    bool getCurrentMode() const {
+        return ignoreUnknown;
+    }
+
+    void setIgnoreUnknown(bool mode) {
+        ignoreUnknown = mode;
+    }
+
+private:
+    // Adopt arrays that are a distribution by construction
+    LogProbabilitySpace(std::vector<T> keys, std::vector<double> logs)
+        : outcomes(std::move(keys)), logProbabilities(std::move(logs)) {}
+};
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef MARKOV_CHAIN_H
+#define MARKOV_CHAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "executor.h"
+#include "probability_space.h"
+#include "summation.h"
+
+
+/**
+ * @brief A Markov chain over a finite set of states, with its transition matrix in CSR form.
+ *
+ * States are numbered in ascending order. Row i of the matrix holds the transition
+ * probabilities out of state i, and the transpose is kept too. A step of a
+ * distribution x is the product xP. Every entry of xP is one row of the transpose,
+ * so the product is computed independently per state. It needs no atomics and can
+ * be split over the threads of an executor, and the sum order of each entry is fixed,
+ * so the results don't depend on the number of threads.
+ *
+ * Distributions are returned as ProbabilitySpaces over all states, in the dense
+ * format and including states of probability 0, so every state can be queried.
+ *
+ * @tparam State The type of states. It must be ordered with <.
+ */
+template <typename State>
+class MarkovChain {
+private:
+    struct SparseMatrix {
+        std::vector<std::size_t> start;
+        std::vector<std::size_t> columns;
+        std::vector<double> values;
+    };
+
+    // Dense accumulator of a row of a sparse product. Every row clears the entries
+    // it touched, so the accumulator is all zeros between rows and is kept per thread
+    // across chunks and products; it is only zeroed when it grows.
+    struct ProductScratch {
+        std::vector<double> accumulator;
+        std::vector<bool> used;
+        std::vector<std::size_t> touched;
+
+        void reserve(std::size_t n) {
+            if (accumulator.size() < n) {
+                accumulator.resize(n, 0.0);
+                used.resize(n, false);
+            }
+        }
+    };
+
+    static ProductScratch& productScratch() {
+        thread_local ProductScratch scratch;
+        return scratch;
+    }
+
+    std::vector<State> states;
+    SparseMatrix rows;
+    SparseMatrix transposed;
+
+    MarkovChain(std::vector<State> states, SparseMatrix rows)
+        : states(std::move(states)), rows(std::move(rows)), transposed(transpose(this->rows, this->states.size())) {}
+
+    static SparseMatrix transpose(const SparseMatrix& matrix, std::size_t n) {
+        SparseMatrix result;
+        result.start.assign(n + 1, 0);
+        for (std::size_t c : matrix.columns) ++result.start[c + 1];
+        for (std::size_t i = 0; i < n; ++i) result.start[i + 1] += result.start[i];
+        result.columns.resize(matrix.columns.size());
+        result.values.resize(matrix.values.size());
+        std::vector<std::size_t> next(result.start.begin(), result.start.end() - 1);
+        // Rows are visited in ascending order, so the columns of the transpose come out sorted
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t e = matrix.start[i]; e < matrix.start[i + 1]; ++e) {
+                std::size_t slot = next[matrix.columns[e]]++;
+                result.columns[slot] = i;
+                result.values[slot] = matrix.values[e];
+            }
+        }
+        return result;
+    }
+
+    std::size_t indexOf(const State& state) const {
+        auto it = std::lower_bound(states.begin(), states.end(), state);
+        if (it == states.end() || state < *it) throw std::invalid_argument("State not in the chain");
+        return static_cast<std::size_t>(it - states.begin());
+    }
+
+    std::vector<double> densityOf(const ProbabilitySpace<State>& distribution) const {
+        std::vector<double> x(states.size(), 0.0);
+        for (std::size_t i = 0; i < distribution.size(); ++i) x[indexOf(distribution.outcomeAt(i))] = distribution.probabilityAt(i);
+        return x;
+    }
+
+    // y = xP, one state of y per iteration
+    void step(const std::vector<double>& x, std::vector<double>& y, WorkStealingExecutor* executor) const {
+        auto body = [&](std::size_t begin, std::size_t end) {
+            for (std::size_t j = begin; j < end; ++j) {
+                double sum = 0.0;
+                for (std::size_t e = transposed.start[j]; e < transposed.start[j + 1]; ++e)
+                    sum += x[transposed.columns[e]] * transposed.values[e];
+                y[j] = sum;
+            }
+        };
+        if (executor) executor->forEachChunk(states.size(), 0, body);
+        else body(0, states.size());
+    }
+
+    // Renormalize away the rounding drift of repeated products
+    ProbabilitySpace<State> spaceOf(std::vector<double> x) const {
+        BlockedSum<NeumaierSum> total;
+        for (double p : x) total.add(p);
+        double scale = 1.0 / total.result();
+        for (double& p : x) p *= scale;
+        return ProbabilitySpace<State>(SORTED_UNIQUE, states, std::move(x));
+    }
+
+    // C = AB row by row with the dense accumulator of the thread
+    static SparseMatrix multiply(const SparseMatrix& a, const SparseMatrix& b, std::size_t n, WorkStealingExecutor* executor) {
+        std::vector<std::vector<std::pair<std::size_t, double>>> products(n);
+        auto body = [&](std::size_t begin, std::size_t end) {
+            ProductScratch& scratch = productScratch();
+            scratch.reserve(n);
+            std::vector<double>& accumulator = scratch.accumulator;
+            std::vector<bool>& used = scratch.used;
+            std::vector<std::size_t>& touched = scratch.touched;
+            for (std::size_t i = begin; i < end; ++i) {
+                touched.clear();
+                for (std::size_t e = a.start[i]; e < a.start[i + 1]; ++e) {
+                    std::size_t k = a.columns[e];
+                    for (std::size_t f = b.start[k]; f < b.start[k + 1]; ++f) {
+                        std::size_t j = b.columns[f];
+                        if (!used[j]) {
+                            used[j] = true;
+                            touched.push_back(j);
+                        }
+                        accumulator[j] += a.values[e] * b.values[f];
+                    }
+                }
+                std::sort(touched.begin(), touched.end());
+                for (std::size_t j : touched) {
+                    if (accumulator[j] != 0.0) products[i].emplace_back(j, accumulator[j]);
+                    accumulator[j] = 0.0;
+                    used[j] = false;
+                }
+            }
+        };
+        if (executor) executor->forEachChunk(n, 0, body);
+        else body(0, n);
+
+        SparseMatrix result;
+        result.start.assign(n + 1, 0);
+        for (std::size_t i = 0; i < n; ++i) result.start[i + 1] = result.start[i] + products[i].size();
+        result.columns.reserve(result.start[n]);
+        result.values.reserve(result.start[n]);
+        for (const auto& row : products) {
+            for (const auto& [j, v] : row) {
+                result.columns.push_back(j);
+                result.values.push_back(v);
+            }
+        }
+        return result;
+    }
+
+    MarkovChain power(unsigned long long k, WorkStealingExecutor* executor) const {
+        SparseMatrix result;
+        result.start.resize(states.size() + 1);
+        for (std::size_t i = 0; i < states.size(); ++i) {
+            result.start[i] = i;
+            result.columns.push_back(i);
+            result.values.push_back(1.0);
+        }
+        result.start[states.size()] = states.size();
+        SparseMatrix base = rows;
+        bool identity = true;
+        for (; k > 0; k >>= 1) {
+            if (k & 1) {
+                result = identity ? base : multiply(result, base, states.size(), executor);
+                identity = false;
+            }
+            if (k > 1) base = multiply(base, base, states.size(), executor);
+        }
+        return MarkovChain(states, std::move(result));
+    }
+
+    ProbabilitySpace<State> propagated(const ProbabilitySpace<State>& distribution, unsigned long long k,
+                                       WorkStealingExecutor* executor) const {
+        std::vector<double> x = densityOf(distribution);
+        std::vector<double> y(states.size());
+        for (unsigned long long s = 0; s < k; ++s) {
+            step(x, y, executor);
+            x.swap(y);
+        }
+        return spaceOf(std::move(x));
+    }
+
+    ProbabilitySpace<State> stationary(double tolerance, std::size_t maxIterations, WorkStealingExecutor* executor) const {
+        std::vector<double> x(states.size(), 1.0 / static_cast<double>(states.size()));
+        std::vector<double> y(states.size());
+        for (std::size_t iteration = 0; iteration < maxIterations; ++iteration) {
+            step(x, y, executor);
+            double change = 0.0;
+            for (std::size_t i = 0; i < x.size(); ++i) {
+                double next = 0.5 * (x[i] + y[i]);
+                change += std::abs(next - x[i]);
+                x[i] = next;
+            }
+            if (change < tolerance) return spaceOf(std::move(x));
+        }
+        throw std::invalid_argument("Power iteration did not converge");
+    }
+
+public:
+    /**
+     * @brief Pack the transition rows of every state into the CSR matrix of the chain.
+     *
+     * @param transitions transitions[s] is the distribution of the state after s.
+     * Outcomes of probability 0 are left out of the matrix.
+     * @throws std::invalid_argument if there are no states or a row leads to a state
+     * without a row of its own.
+     */
+    explicit MarkovChain(const std::map<State, ProbabilitySpace<State>>& transitions) {
+        if (transitions.empty()) throw std::invalid_argument("A Markov chain needs at least one state");
+        states.reserve(transitions.size());
+        for (const auto& entry : transitions) states.push_back(entry.first);
+        rows.start.reserve(states.size() + 1);
+        rows.start.push_back(0);
+        for (const auto& entry : transitions) {
+            const ProbabilitySpace<State>& row = entry.second;
+            std::size_t pos = 0;
+            for (std::size_t e = 0; e < row.size(); ++e) {
+                if (row.probabilityAt(e) == 0.0) continue;
+                // The outcomes of a row are sorted, so the search only moves forward
+                pos = static_cast<std::size_t>(std::lower_bound(states.begin() + pos, states.end(), row.outcomeAt(e)) - states.begin());
+                if (pos == states.size() || row.outcomeAt(e) < states[pos])
+                    throw std::invalid_argument("Every state needs a transition row");
+                rows.columns.push_back(pos);
+                rows.values.push_back(row.probabilityAt(e));
+            }
+            rows.start.push_back(rows.columns.size());
+        }
+        transposed = transpose(rows, states.size());
+    }
+
+    // Number of states
+    std::size_t size() const {
+        return states.size();
+    }
+
+    // Number of nonzero transition probabilities
+    std::size_t transitions() const {
+        return rows.values.size();
+    }
+
+    // States in ascending order
+    const std::vector<State>& stateSpace() const {
+        return states;
+    }
+
+    /**
+     * @brief The distribution of the next state after a state.
+     *
+     * @return The nonzero transitions out of the state.
+     * @throws std::invalid_argument if the state is not in the chain.
+     */
+    ProbabilitySpace<State> row(const State& state) const {
+        std::size_t i = indexOf(state);
+        std::vector<State> keys;
+        std::vector<double> probs(rows.values.begin() + rows.start[i], rows.values.begin() + rows.start[i + 1]);
+        for (std::size_t e = rows.start[i]; e < rows.start[i + 1]; ++e) keys.push_back(states[rows.columns[e]]);
+        return ProbabilitySpace<State>(SORTED_UNIQUE, std::move(keys), std::move(probs));
+    }
+
+    /**
+     * @brief Propagate a distribution by k steps, one sparse product per step.
+     *
+     * @param distribution A distribution over states of the chain.
+     * @throws std::invalid_argument if the distribution has an outcome that is not a state.
+     */
+    ProbabilitySpace<State> propagate(const ProbabilitySpace<State>& distribution, unsigned long long k = 1) const {
+        return propagated(distribution, k, nullptr);
+    }
+
+    // Propagate with every step split over the threads of an executor
+    ProbabilitySpace<State> propagate(const ProbabilitySpace<State>& distribution, unsigned long long k,
+                                      WorkStealingExecutor& executor) const {
+        return propagated(distribution, k, &executor);
+    }
+
+    /**
+     * @brief The k-step chain with transition matrix P^k.
+     *
+     * Computed by repeated squaring in O(log k) sparse matrix products. Propagating
+     * with the result answers k-step queries with one product each, which pays off
+     * when many distributions are propagated by the same k.
+     */
+    MarkovChain power(unsigned long long k) const {
+        return power(k, nullptr);
+    }
+
+    MarkovChain power(unsigned long long k, WorkStealingExecutor& executor) const {
+        return power(k, &executor);
+    }
+
+    /**
+     * @brief Find the stationary distribution by power iteration.
+     *
+     * Iterates the lazy chain (I + P) / 2. It has the same stationary distributions
+     * as P but isn't periodic, so the iteration also converges for periodic chains.
+     *
+     * @param tolerance Stop once a step changes the distribution by less than this in L1 norm.
+     * @throws std::invalid_argument if the iteration doesn't converge within maxIterations.
+     */
+    ProbabilitySpace<State> stationaryDistribution(double tolerance = 1e-12, std::size_t maxIterations = 1000000) const {
+        return stationary(tolerance, maxIterations, nullptr);
+    }
+
+    ProbabilitySpace<State> stationaryDistribution(WorkStealingExecutor& executor, double tolerance = 1e-12,
+                                                   std::size_t maxIterations = 1000000) const {
+        return stationary(tolerance, maxIterations, &executor);
+    }
+};
+
+#endif
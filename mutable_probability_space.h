@@ -0,0 +1,363 @@
+#ifndef MUTABLE_PROBABILITY_SPACE_H
+#define MUTABLE_PROBABILITY_SPACE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "probability_space.h"
+#include "sampling.h"
+
+
+/**
+ * @brief A probability space whose outcomes can be re-weighted, added and removed.
+ *
+ * Outcomes carry nonnegative weights that don't need to sum to one. Probabilities
+ * are normalized lazily by the running total, so an update never touches the other
+ * outcomes. The weights are kept in a Fenwick tree in the order of the outcomes,
+ * which makes weight updates, removals, range sums and sampling O(log n) and the
+ * total O(1). Adding an outcome that was never in the space shifts the ordered
+ * storage and costs O(n).
+ *
+ * Incremental updates add rounding drift to the tree and the total, so both are
+ * rebuilt from the weights after max(MIN_REBUILD_INTERVAL, n) updates, which adds
+ * amortized O(1) per update, and as soon as cancellation shrinks the total below
+ * DRIFT_THRESHOLD times its last rebuilt value. A total that is only drift, e.g.
+ * after every weight was set to 0, is therefore recomputed as exactly 0.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class MutableProbabilitySpace {
+private:
+    // Outcomes in ascending order. Removed outcomes stay in place with weight 0
+    // until too many of them pile up and the storage is compacted.
+    std::vector<T> outcomes;
+    std::vector<double> weights;
+    std::vector<bool> removed;
+    std::size_t removedCount = 0;
+    // Fenwick tree over weights, 1-based
+    std::vector<double> tree;
+    double total = 0.0;
+    // Total after the last rebuild and the number of incremental updates since
+    double rebuiltTotal = 0.0;
+    std::size_t updatesSinceRebuild = 0;
+    std::uint64_t revision = 0;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    static constexpr std::size_t MIN_REBUILD_INTERVAL = 1024;
+    static constexpr double DRIFT_THRESHOLD = 1e-8;
+
+    static void validWeight(double weight) {
+        if (!(std::isfinite(weight) && weight >= 0.0)) throw std::invalid_argument("Weights must be nonnegative and finite");
+    }
+
+    // Position of a live outcome, npos if it is not in the space
+    std::size_t find(const T& outcome) const {
+        auto it = std::lower_bound(outcomes.begin(), outcomes.end(), outcome);
+        if (it == outcomes.end() || outcome < *it) return npos;
+        std::size_t pos = static_cast<std::size_t>(it - outcomes.begin());
+        return removed[pos] ? npos : pos;
+    }
+
+    std::size_t position(const T& outcome) const {
+        std::size_t pos = find(outcome);
+        if (pos == npos) throw std::invalid_argument("Outcome not in sample space");
+        return pos;
+    }
+
+    void addToTree(std::size_t pos, double delta) {
+        for (std::size_t i = pos + 1; i < tree.size(); i += i & (~i + 1)) tree[i] += delta;
+    }
+
+    // Total weight of the first count outcomes
+    double prefix(std::size_t count) const {
+        double sum = 0.0;
+        for (std::size_t i = count; i > 0; i -= i & (~i + 1)) sum += tree[i];
+        return sum;
+    }
+
+    // Rebuild the tree and the total from the weights in O(n). This also clears
+    // any rounding drift accumulated by incremental updates.
+    void rebuild() {
+        tree.assign(weights.size() + 1, 0.0);
+        total = 0.0;
+        for (std::size_t i = 1; i < tree.size(); ++i) {
+            tree[i] += weights[i - 1];
+            total += weights[i - 1];
+            std::size_t parent = i + (i & (~i + 1));
+            if (parent < tree.size()) tree[parent] += tree[i];
+        }
+        rebuiltTotal = total;
+        updatesSinceRebuild = 0;
+    }
+
+    // Rebuild when incremental updates may have drifted too far
+    void settle() {
+        if (++updatesSinceRebuild >= std::max(MIN_REBUILD_INTERVAL, weights.size()) || total < rebuiltTotal * DRIFT_THRESHOLD)
+            rebuild();
+    }
+
+    void compact() {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < outcomes.size(); ++i) {
+            if (removed[i]) continue;
+            outcomes[kept] = std::move(outcomes[i]);
+            weights[kept] = weights[i];
+            ++kept;
+        }
+        outcomes.resize(kept);
+        weights.resize(kept);
+        removed.assign(kept, false);
+        removedCount = 0;
+        rebuild();
+    }
+
+    double normalizer() const {
+        if (!(total > 0.0)) throw std::invalid_argument("Total weight must be positive");
+        return 1.0 / total;
+    }
+
+public:
+    MutableProbabilitySpace() = default;
+
+    /**
+     * @brief Construct a space from a mapping of outcomes to nonnegative weights.
+     *
+     * @param mapping Weights of the outcomes; they are normalized by their total.
+     * @throws std::invalid_argument if a weight is negative or not finite.
+     */
+    explicit MutableProbabilitySpace(const std::map<T, double>& mapping) {
+        outcomes.reserve(mapping.size());
+        weights.reserve(mapping.size());
+        for (const auto& [k, v] : mapping) {
+            validWeight(v);
+            outcomes.push_back(k);
+            weights.push_back(v);
+        }
+        removed.assign(outcomes.size(), false);
+        rebuild();
+    }
+
+    /**
+     * @brief Set the weight of an outcome already in the space in O(log n).
+     *
+     * @throws std::invalid_argument if the outcome is unknown or the weight is negative or not finite.
+     */
+    void updateWeight(const T& outcome, double weight) {
+        validWeight(weight);
+        std::size_t pos = position(outcome);
+        double delta = weight - weights[pos];
+        weights[pos] = weight;
+        addToTree(pos, delta);
+        total += delta;
+        settle();
+        ++revision;
+    }
+
+    /**
+     * @brief Update the space in place as a prior by an observation, in O(n).
+     *
+     * Every weight is multiplied by the likelihood of its outcome in one pass and
+     * the tree is rebuilt once. Normalization stays lazy as for every other update.
+     *
+     * @param likelihood Callable mapping an outcome to its likelihood, up to a constant factor.
+     * @throws std::invalid_argument if a likelihood is negative or not finite. The
+     * space is unchanged then.
+     */
+    template <typename F>
+    void bayesUpdate(F likelihood) {
+        std::vector<double> updated(weights.size(), 0.0);
+        for (std::size_t i = 0; i < outcomes.size(); ++i) {
+            if (removed[i]) continue;
+            double l = likelihood(outcomes[i]);
+            if (!(l >= 0.0 && l <= std::numeric_limits<double>::max()))
+                throw std::invalid_argument("Likelihoods must be nonnegative and finite");
+            updated[i] = weights[i] * l;
+        }
+        weights.swap(updated);
+        rebuild();
+        ++revision;
+    }
+
+    /**
+     * @brief Add a new outcome with the given weight.
+     *
+     * Re-adding a removed outcome is O(log n); a never seen outcome costs O(n).
+     *
+     * @throws std::invalid_argument if the outcome is already in the space or the weight is negative or not finite.
+     */
+    void addOutcome(const T& outcome, double weight) {
+        validWeight(weight);
+        auto it = std::lower_bound(outcomes.begin(), outcomes.end(), outcome);
+        std::size_t pos = static_cast<std::size_t>(it - outcomes.begin());
+        if (it != outcomes.end() && !(outcome < *it)) {
+            if (!removed[pos]) throw std::invalid_argument("Outcome already in sample space");
+            removed[pos] = false;
+            --removedCount;
+            weights[pos] = weight;
+            addToTree(pos, weight);
+            total += weight;
+            settle();
+        }
+        else {
+            outcomes.insert(it, outcome);
+            weights.insert(weights.begin() + static_cast<std::ptrdiff_t>(pos), weight);
+            removed.insert(removed.begin() + static_cast<std::ptrdiff_t>(pos), false);
+            rebuild();
+        }
+        ++revision;
+    }
+
+    /**
+     * @brief Remove an outcome from the space in amortized O(log n).
+     *
+     * @throws std::invalid_argument if the outcome is not in the space.
+     */
+    void removeOutcome(const T& outcome) {
+        std::size_t pos = position(outcome);
+        addToTree(pos, -weights[pos]);
+        total -= weights[pos];
+        weights[pos] = 0.0;
+        removed[pos] = true;
+        ++removedCount;
+        if (2 * removedCount > outcomes.size()) compact();
+        else settle();
+        ++revision;
+    }
+
+    bool contains(const T& outcome) const {
+        return find(outcome) != npos;
+    }
+
+    // Number of outcomes in the space
+    std::size_t size() const {
+        return outcomes.size() - removedCount;
+    }
+
+    double totalWeight() const {
+        return total;
+    }
+
+    double weightOf(const T& outcome) const {
+        return weights[position(outcome)];
+    }
+
+    // Counter increased by every mutation, for callers caching derived results
+    std::uint64_t version() const {
+        return revision;
+    }
+
+    double probabilityOf(const T& outcome) const {
+        return weights[position(outcome)] * normalizer();
+    }
+
+    /**
+     * @brief Calculate the probability of an event.
+     *
+     * @throws std::invalid_argument if the event contains an outcome not in the space
+     * or the total weight is 0.
+     */
+    double probabilityOfSet(const std::set<T>& event) const {
+        double sum = 0.0;
+        for (const auto& outcome : event) {
+            std::size_t pos = find(outcome);
+            if (pos == npos) throw std::invalid_argument("Event contains outcome not in sample space");
+            sum += weights[pos];
+        }
+        return sum * normalizer();
+    }
+
+    /**
+     * @brief Calculate P(A|B) as the weight of A n B over the weight of B.
+     *
+     * The normalization cancels, so the total weight isn't needed. Both events are
+     * sorted, so A n B is found in one merge walk.
+     *
+     * @throws std::invalid_argument if an event contains an outcome not in the space
+     * or P(B)=0.
+     */
+    double conditionalProbability(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        for (const auto& outcome : eventA) {
+            if (find(outcome) == npos) throw std::invalid_argument("Event contains outcome not in sample space");
+        }
+        double weightB = 0.0;
+        double weightAB = 0.0;
+        auto a = eventA.begin();
+        for (const auto& outcome : eventB) {
+            std::size_t pos = find(outcome);
+            if (pos == npos) throw std::invalid_argument("Event contains outcome not in sample space");
+            weightB += weights[pos];
+            while (a != eventA.end() && *a < outcome) ++a;
+            if (a != eventA.end() && !(outcome < *a)) weightAB += weights[pos];
+        }
+        if (!(weightB > 0.0))
+            throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
+        return weightAB / weightB;
+    }
+
+    // P(lo <= X <= hi) in O(log n), 0 if hi < lo
+    double probabilityOfRange(const T& lo, const T& hi) const {
+        if (hi < lo) return 0.0;
+        auto first = std::lower_bound(outcomes.begin(), outcomes.end(), lo) - outcomes.begin();
+        auto last = std::upper_bound(outcomes.begin(), outcomes.end(), hi) - outcomes.begin();
+        return (prefix(static_cast<std::size_t>(last)) - prefix(static_cast<std::size_t>(first))) * normalizer();
+    }
+
+    // P(X <= x) in O(log n)
+    double cumulativeProbability(const T& x) const {
+        auto last = std::upper_bound(outcomes.begin(), outcomes.end(), x) - outcomes.begin();
+        return prefix(static_cast<std::size_t>(last)) * normalizer();
+    }
+
+    /**
+     * @brief Draw an outcome in O(log n) by descending the Fenwick tree.
+     *
+     * @throws std::invalid_argument if the total weight is 0.
+     */
+    template <typename URBG>
+    const T& sample(URBG& rng) const {
+        normalizer();
+        double target = uniformUnit(rng) * total;
+        std::size_t pos = 0;
+        std::size_t step = 1;
+        while (2 * step < tree.size()) step *= 2;
+        for (; step > 0; step /= 2) {
+            if (pos + step < tree.size() && tree[pos + step] <= target) {
+                pos += step;
+                target -= tree[pos];
+            }
+        }
+        // Rounding can push the target past the last outcome with weight
+        pos = std::min(pos, weights.size() - 1);
+        while (pos > 0 && weights[pos] == 0.0) --pos;
+        return outcomes[pos];
+    }
+
+    /**
+     * @brief Freeze the current normalized distribution into an immutable ProbabilitySpace.
+     *
+     * @throws std::invalid_argument if the total weight is 0.
+     */
+    ProbabilitySpace<T> snapshot() const {
+        double scale = normalizer();
+        std::vector<T> keys;
+        std::vector<double> probs;
+        keys.reserve(size());
+        probs.reserve(size());
+        for (std::size_t i = 0; i < outcomes.size(); ++i) {
+            if (removed[i]) continue;
+            keys.push_back(outcomes[i]);
+            probs.push_back(weights[i] * scale);
+        }
+        return ProbabilitySpace<T>(SORTED_UNIQUE, std::move(keys), std::move(probs));
+    }
+};
+
+#endif
@@ -1,170 +1,1852 @@
+#ifndef PROBABILITY_SPACE_H
+#define PROBABILITY_SPACE_H
+
 #include <map>
 #include <stdexcept>
 #include <cmath>
 #include <set>
 #include <algorithm>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include <memory>
+#include <optional>
+#include <limits>
+#include <memory_resource>
+
+#include "executor.h"
+#include "instrumentation.h"
+#include "scratch_arena.h"
+#include "summation.h"
 
 // Define the accuracy required for valid probability spaces
 // to add up to one
 constexpr double EPSILON = 1e-9;
 
+/**
+ * @brief Tolerance for the total of n probabilities to be accepted as one.
+ *
+ * EPSILON is the accuracy required of the input. Computing and summing n terms
+ * adds up to n rounding errors of one unit each on top of it, so the tolerance
+ * grows with the size of the sample space instead of rejecting large valid spaces.
+ */
+constexpr double sumTolerance(std::size_t n) {
+    return EPSILON + static_cast<double>(n) * std::numeric_limits<double>::epsilon();
+}
+
+// Integral outcomes whose range max - min + 1 is at most this many times the
+// number of outcomes are looked up through a direct index instead of a search
+constexpr std::size_t DIRECT_INDEX_SPREAD = 2;
+
+
+/**
+ * @brief An event of a fixed sample space, stored as a bitset over the indices
+ * of the outcomes in the space.
+ *
+ * Masks are created by ProbabilitySpace::maskOf() and combined with the bitwise
+ * operators: | is the union, & the intersection and ~ the complement. Masks of
+ * sample spaces with different sizes cannot be combined.
+ */
+class EventMask {
+private:
+    static constexpr std::size_t WORD_BITS = 64;
+
+    std::vector<std::uint64_t> words;
+    std::size_t bits = 0;
+
+    void sameSize(const EventMask& other) const {
+        if (bits != other.bits)
+            throw std::invalid_argument("Event masks belong to sample spaces of different sizes");
+    }
+
+    // Keep the unused bits of the last word zero, so that counting and
+    // comparing never need to special-case them.
+    void clearPadding() {
+        if (bits % WORD_BITS != 0)
+            words.back() &= (std::uint64_t{1} << (bits % WORD_BITS)) - 1;
+    }
+
+public:
+    EventMask() = default;
+
+    /**
+     * @brief Construct an empty event over a sample space with the given number of outcomes.
+     *
+     * @param size The number of outcomes in the sample space.
+     */
+    explicit EventMask(std::size_t size) : words((size + WORD_BITS - 1) / WORD_BITS, 0), bits(size) {}
+
+    std::size_t size() const { return bits; }
+
+    bool test(std::size_t index) const {
+        return (words[index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+    }
+
+    void set(std::size_t index) {
+        words[index / WORD_BITS] |= std::uint64_t{1} << (index % WORD_BITS);
+    }
+
+    void reset(std::size_t index) {
+        words[index / WORD_BITS] &= ~(std::uint64_t{1} << (index % WORD_BITS));
+    }
+
+    // Number of outcomes in the event
+    std::size_t count() const {
+        std::size_t total = 0;
+        for (auto word : words) total += static_cast<std::size_t>(__builtin_popcountll(word));
+        return total;
+    }
+
+    const std::vector<std::uint64_t>& data() const { return words; }
+
+    EventMask& operator|=(const EventMask& other) {
+        sameSize(other);
+        for (std::size_t i = 0; i < words.size(); ++i) words[i] |= other.words[i];
+        return *this;
+    }
+
+    EventMask& operator&=(const EventMask& other) {
+        sameSize(other);
+        for (std::size_t i = 0; i < words.size(); ++i) words[i] &= other.words[i];
+        return *this;
+    }
+
+    EventMask operator~() const {
+        EventMask result(*this);
+        for (auto& word : result.words) word = ~word;
+        result.clearPadding();
+        return result;
+    }
+
+    friend EventMask operator|(EventMask a, const EventMask& b) { return a |= b; }
+    friend EventMask operator&(EventMask a, const EventMask& b) { return a &= b; }
+
+    friend bool operator==(const EventMask& a, const EventMask& b) {
+        return a.bits == b.bits && a.words == b.words;
+    }
+
+    friend bool operator!=(const EventMask& a, const EventMask& b) { return !(a == b); }
+};
+
+/**
+ * @brief Base of the lazy event expressions over the outcome indices of a space.
+ *
+ * Expressions are built from masks with lazy() and from outcome ranges with
+ * ProbabilitySpace::rangeEvent(), and combined with | for the union, & for the
+ * intersection and ~ for the complement. Combining only builds a tree of small
+ * nodes; nothing is evaluated until the expression is queried, which evaluates the
+ * whole tree one 64-bit word of outcomes at a time in a single pass, so no
+ * intermediate event is ever materialized. A node reports the word of its event
+ * with word(w) and the number of outcomes of its space with size().
+ *
+ * Leaves refer to their masks, which must outlive the expression.
+ *
+ * @tparam E The type of the expression node.
+ */
+template <typename E>
+struct EventExpression {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+// A mask as a leaf of an expression
+class MaskTerm : public EventExpression<MaskTerm> {
+private:
+    const EventMask* mask;
+
+public:
+    explicit MaskTerm(const EventMask& mask) : mask(&mask) {}
+
+    std::size_t size() const { return mask->size(); }
+    std::uint64_t word(std::size_t w) const { return mask->data()[w]; }
+};
+
+// The outcomes at indices [first, last) as a leaf of an expression
+class RangeTerm : public EventExpression<RangeTerm> {
+private:
+    std::size_t first;
+    std::size_t last;
+    std::size_t bits;
+
+public:
+    RangeTerm(std::size_t first, std::size_t last, std::size_t size) : first(first), last(last), bits(size) {}
+
+    std::size_t size() const { return bits; }
+
+    std::uint64_t word(std::size_t w) const {
+        std::size_t lo = std::max(first, w * 64);
+        std::size_t hi = std::min(last, w * 64 + 64);
+        if (hi <= lo) return 0;
+        std::uint64_t run = hi - lo == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << (hi - lo)) - 1;
+        return run << (lo - w * 64);
+    }
+};
+
+// Start a lazy expression from a mask
+inline MaskTerm lazy(const EventMask& mask) {
+    return MaskTerm(mask);
+}
+
+template <typename A, typename B>
+class EventUnion : public EventExpression<EventUnion<A, B>> {
+private:
+    A a;
+    B b;
+
+public:
+    EventUnion(const A& a, const B& b) : a(a), b(b) {
+        if (a.size() != b.size())
+            throw std::invalid_argument("Event masks belong to sample spaces of different sizes");
+    }
+
+    std::size_t size() const { return a.size(); }
+    std::uint64_t word(std::size_t w) const { return a.word(w) | b.word(w); }
+};
+
+template <typename A, typename B>
+class EventIntersection : public EventExpression<EventIntersection<A, B>> {
+private:
+    A a;
+    B b;
+
+public:
+    EventIntersection(const A& a, const B& b) : a(a), b(b) {
+        if (a.size() != b.size())
+            throw std::invalid_argument("Event masks belong to sample spaces of different sizes");
+    }
+
+    std::size_t size() const { return a.size(); }
+    std::uint64_t word(std::size_t w) const { return a.word(w) & b.word(w); }
+};
+
+template <typename A>
+class EventComplement : public EventExpression<EventComplement<A>> {
+private:
+    A a;
+
+public:
+    explicit EventComplement(const A& a) : a(a) {}
+
+    std::size_t size() const { return a.size(); }
+
+    // The bits past the last outcome stay zero
+    std::uint64_t word(std::size_t w) const {
+        std::uint64_t result = ~a.word(w);
+        if (w == size() / 64) result &= (std::uint64_t{1} << (size() % 64)) - 1;
+        return result;
+    }
+};
+
+template <typename A, typename B>
+EventUnion<A, B> operator|(const EventExpression<A>& a, const EventExpression<B>& b) {
+    return EventUnion<A, B>(a.self(), b.self());
+}
+
+template <typename A>
+EventUnion<A, MaskTerm> operator|(const EventExpression<A>& a, const EventMask& b) {
+    return EventUnion<A, MaskTerm>(a.self(), MaskTerm(b));
+}
+
+template <typename B>
+EventUnion<MaskTerm, B> operator|(const EventMask& a, const EventExpression<B>& b) {
+    return EventUnion<MaskTerm, B>(MaskTerm(a), b.self());
+}
+
+template <typename A, typename B>
+EventIntersection<A, B> operator&(const EventExpression<A>& a, const EventExpression<B>& b) {
+    return EventIntersection<A, B>(a.self(), b.self());
+}
+
+template <typename A>
+EventIntersection<A, MaskTerm> operator&(const EventExpression<A>& a, const EventMask& b) {
+    return EventIntersection<A, MaskTerm>(a.self(), MaskTerm(b));
+}
+
+template <typename B>
+EventIntersection<MaskTerm, B> operator&(const EventMask& a, const EventExpression<B>& b) {
+    return EventIntersection<MaskTerm, B>(MaskTerm(a), b.self());
+}
+
+template <typename A>
+EventComplement<A> operator~(const EventExpression<A>& a) {
+    return EventComplement<A>(a.self());
+}
+
+
+/**
+ * @brief A read-only view of a contiguous array.
+ *
+ * ProbabilitySpace reads its dense storage through views, so the same kernels
+ * work whether the arrays are owned by the space or by the caller.
+ */
+template <typename U>
+class ArrayView {
+private:
+    const U* first = nullptr;
+    std::size_t count = 0;
+
+public:
+    ArrayView() = default;
+    ArrayView(const U* data, std::size_t size) : first(data), count(size) {}
+
+    const U* data() const { return first; }
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const U* begin() const { return first; }
+    const U* end() const { return first + count; }
+    const U& operator[](std::size_t i) const { return first[i]; }
+};
+
+/**
+ * @brief Tag telling a ProbabilitySpace constructor that the outcomes are already
+ * sorted in ascending order and unique, so they don't need to be sorted.
+ */
+struct SortedUniqueTag {
+    explicit SortedUniqueTag() = default;
+};
+
+constexpr SortedUniqueTag SORTED_UNIQUE{};
+
+/**
+ * @brief Reasons a query on a probability space can fail.
+ */
+enum class QueryError {
+    None,
+    // The event contains an outcome not in the sample space
+    UnknownOutcome,
+    // The condition B of P(A|B) has P(B)=0
+    ZeroProbabilityCondition,
+    // An event given as a range is not sorted and unique
+    UnsortedEvent,
+    // A validated event was created by another space
+    ForeignEvent
+};
+
+/**
+ * @brief The result of a query that reports failures instead of throwing.
+ */
+struct QueryResult {
+    double probability = 0.0;
+    QueryError error = QueryError::None;
+
+    bool ok() const { return error == QueryError::None; }
+
+    // The probability if the query succeeded
+    std::optional<double> value() const {
+        return ok() ? std::optional<double>(probability) : std::nullopt;
+    }
+};
+
+template <typename T, typename Sum = NaiveSum>
+class ProbabilitySpace;
+
+template <typename T, typename Sum = NaiveSum>
+class ConditionedSpace;
+
+class ProbabilitySpaceFile;
+
+class DiscreteDistribution;
+
+/**
+ * @brief An event whose outcomes have already been checked against one probability space.
+ *
+ * A ValidatedEvent can only be created by ProbabilitySpace::validate(), which checks
+ * every outcome once and records the positions of the outcomes in the dense storage
+ * of the space. Queries on validated events skip all membership checks and lookups.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class ValidatedEvent {
+private:
+    template <typename, typename> friend class ProbabilitySpace;
+
+    std::vector<std::size_t> indices;
+    const void* owner;
+    std::size_t spaceSize;
+
+    ValidatedEvent(std::vector<std::size_t> indices, const void* owner, std::size_t spaceSize)
+        : indices(std::move(indices)), owner(owner), spaceSize(spaceSize) {}
+
+public:
+    // Number of outcomes of the sample space in the event
+    std::size_t size() const { return indices.size(); }
+
+    // Sorted positions of the outcomes in the dense storage of the space
+    const std::vector<std::size_t>& outcomeIndices() const { return indices; }
+};
 
 /**
  * @brief
  * 
  * @tparam T The type of outcomes in the probability space.
+ * @tparam Sum The summation policy of the event kernels, NaiveSum, NeumaierSum or
+ * PairwiseSum. Every kernel sums in blocks of SUM_BLOCK terms, so results are the
+ * same whether an event is summed serially or on any number of threads.
  */
-template <typename T>
+template <typename T, typename Sum>
 class ProbabilitySpace {
 private:
-    std::map<T, double> space;
-    std::set<T> events;
+    template <typename, typename> friend class ProbabilitySpace;
+    friend class ConditionedSpace<T, Sum>;
+    friend class ProbabilitySpaceFile;
+    friend class DiscreteDistribution;
+
+    // Arrays owned by a space, shared by all of its copies. A space that views
+    // caller-owned memory only owns the prefix sums and keeps the caller's
+    // owner handle alive.
+    struct Storage {
+        std::vector<T> outcomes;
+        std::vector<double> probabilities;
+        std::vector<double> cumulative;
+        std::vector<std::size_t> lowerBounds;
+        std::shared_ptr<const void> external;
+    };
+
+    // How outcomes are found in the dense storage. Integral outcomes spanning
+    // a dense range [min, max] are indexed directly by k - min: a contiguous
+    // range is its own index, a range with gaps gets a table holding the lower
+    // bound of every key. Everything else falls back to a binary search.
+    enum class KeyIndex : unsigned char { Search, Contiguous, Table };
+
+    static constexpr bool INTEGRAL_OUTCOMES = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+    std::shared_ptr<const Storage> storage;
+    // Outcomes of the sample space in ascending order. Each outcome is stored
+    // exactly once; probabilities[i] is the probability of outcomes[i].
+    ArrayView<T> outcomes;
+    ArrayView<double> probabilities;
+    // cumulative[i] is the total probability of the first i outcomes, so it has
+    // one entry more than outcomes and cumulative[0] is 0.
+    ArrayView<double> cumulative;
+    KeyIndex keyIndex = KeyIndex::Search;
+    // lowerBounds[k - min] is lowerBound(k) for the keys of a Table index
+    ArrayView<std::size_t> lowerBounds;
     bool ignoreUnknown = false;
-    
+
+    using Accumulator = BlockedSum<Sum>;
+
+    // Restrict the range overloads to iterators over outcomes, so that e.g.
+    // two ints are never mistaken for an iterator range.
+    template <typename It>
+    using EnableIfOutcomeIterator = std::enable_if_t<
+        std::is_convertible_v<typename std::iterator_traits<It>::value_type, T>>;
+
     /**
-     * @brief Get the keys of the given mapping.
+     * @brief Find the position of an outcome in the dense storage.
      *
-     * @param pSpace A mapping from type T to double.
-     * @return A set containing the domain of the mapping.
+     * @param outcome The outcome to look for.
+     * @param first Position to start searching from. Events are sorted, so callers
+     * walking an event can pass the previous position to keep the search monotone.
+     * @return The first position whose outcome is not less than the given outcome.
      */
-    static std::set<T> getKeys(const std::map<T, double>& pSpace) {
-	std::set<T> result;
-	std::transform(pSpace.begin(), pSpace.end(),
-		       std::inserter(result, result.end()),
-		       [](auto pair){ return pair.first; });
-	return result;
+    std::size_t lowerBound(const T& outcome, std::size_t first = 0) const {
+        if constexpr (INTEGRAL_OUTCOMES) {
+            if (keyIndex != KeyIndex::Search) {
+                std::size_t pos;
+                if (outcome < outcomes[0]) pos = 0;
+                else if (outcomes[outcomes.size() - 1] < outcome) pos = outcomes.size();
+                else if (keyIndex == KeyIndex::Contiguous) pos = keyOffset(outcome);
+                else pos = lowerBounds[keyOffset(outcome)];
+                return std::max(pos, first);
+            }
+        }
+        auto it = std::lower_bound(outcomes.begin() + first, outcomes.end(), outcome);
+        return static_cast<std::size_t>(it - outcomes.begin());
+    }
+
+    // Distance of an integral outcome from the smallest one, without overflow
+    std::size_t keyOffset(const T& outcome) const {
+        using Unsigned = std::make_unsigned_t<T>;
+        return static_cast<std::size_t>(static_cast<Unsigned>(outcome) - static_cast<Unsigned>(outcomes[0]));
+    }
+
+    // Choose the key index for the outcomes and build its table if it needs one.
+    // Must be called once the outcome view is set, before the storage is shared.
+    void indexKeys(Storage& owned) {
+        keyIndex = KeyIndex::Search;
+        lowerBounds = ArrayView<std::size_t>();
+        if constexpr (INTEGRAL_OUTCOMES) {
+            std::size_t n = outcomes.size();
+            if (n == 0) return;
+            std::size_t span = keyOffset(outcomes[n - 1]);
+            if (span == n - 1) {
+                keyIndex = KeyIndex::Contiguous;
+            }
+            else if (span / DIRECT_INDEX_SPREAD < n) {
+                owned.lowerBounds.resize(span + 1);
+                std::size_t pos = 0;
+                for (std::size_t k = 0; k <= span; ++k) {
+                    if (keyOffset(outcomes[pos]) < k) ++pos;
+                    owned.lowerBounds[k] = pos;
+                }
+                PROBABILITY_ENGINE_COUNT_BYTES(owned.lowerBounds.capacity() * sizeof(std::size_t));
+                lowerBounds = ArrayView<std::size_t>(owned.lowerBounds.data(), owned.lowerBounds.size());
+                keyIndex = KeyIndex::Table;
+            }
+        }
+    }
+
+    bool isOutcomeAt(const T& outcome, std::size_t pos) const {
+        return pos < outcomes.size() && !(outcome < outcomes[pos]);
+    }
+
+    // Events passed as iterator ranges must be sorted in ascending order and
+    // contain every outcome once, just like a std::set<T>.
+    template <typename It>
+    static bool sortedEvent(It first, It last) {
+        return std::adjacent_find(first, last, [](const T& a, const T& b){ return !(a < b); }) == last;
+    }
+
+    template <typename It>
+    static void isSortedEvent(It first, It last) {
+        if (!sortedEvent(first, last))
+            throw std::invalid_argument("Event outcomes must be sorted and unique");
+    }
+
+    // Advance the cursor of a sorted walk to the given outcome and report
+    // whether it is in the sample space.
+    bool locate(const T& outcome, std::size_t& pos) const {
+        pos = lowerBound(outcome, pos);
+        return isOutcomeAt(outcome, pos);
+    }
+
+    // Turn the result of a try* query into the value of the throwing API.
+    // Failures were already counted by the query.
+    static double unwrap(const QueryResult& result) {
+        switch (result.error) {
+            case QueryError::UnknownOutcome:
+                throw std::invalid_argument("Event contains outcome not in sample space");
+            case QueryError::ZeroProbabilityCondition:
+                throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
+            case QueryError::UnsortedEvent:
+                throw std::invalid_argument("Event outcomes must be sorted and unique");
+            case QueryError::ForeignEvent:
+                throw std::invalid_argument("Validated event does not belong to this sample space");
+            default:
+                return result.probability;
+        }
+    }
+
+    // Turn the result of a kernel into the value of the throwing API.
+    static double valueOf(const QueryResult& result) {
+        return unwrap(counted(result));
+    }
+
+    static QueryResult counted(const QueryResult& result) noexcept {
+        if (result.error != QueryError::None) PROBABILITY_ENGINE_COUNT_FAILURE();
+        return result;
     }
 
-    void isSubset(const std::set<T>& event) const {
-	    
-        if (!this->ignoreUnknown && !std::includes(this->events.begin(), this->events.end(),
-			   event.begin(), event.end())) {
-            throw std::invalid_argument("Event contains outcome not in sample space");
-	}
+    // Build the prefix sums with Kahan compensation, so that the sums for large
+    // sample spaces don't drift away from the exact running totals.
+    static std::vector<double> buildCumulative(const double* probs, std::size_t size) {
+        std::vector<double> result(size + 1, 0.0);
+        double sum = 0.0;
+        double compensation = 0.0;
+        for (std::size_t i = 0; i < size; ++i) {
+            double y = probs[i] - compensation;
+            double t = sum + y;
+            compensation = (t - sum) - y;
+            sum = t;
+            result[i + 1] = sum;
+        }
+        return result;
     }
 
-    static void validProbabilitySpace(const std::map<T, double>& mapping) {
-        double total = 0.0;
-    
-        for (const auto& [k, v] : mapping) {
-            if( v < 0.0) throw std::invalid_argument("Probabilities must be nonnegative");
-            total += v;
+    // The total is summed with Neumaier compensation whatever the policy of the
+    // kernels, so the check doesn't reject large sample spaces for the rounding
+    // error of a naive sum, and compared within sumTolerance() of the size for the
+    // rounding errors of the probabilities themselves.
+    static void validProbabilitySpace(const double* probs, std::size_t size) {
+        BlockedSum<NeumaierSum> total;
+
+        for (std::size_t i = 0; i < size; ++i) {
+            if (probs[i] < 0.0) throw std::invalid_argument("Probabilities must be nonnegative");
+            total.add(probs[i]);
         }
 
-        if (std::abs(total - 1.0) > EPSILON)
+        if (std::abs(total.result() - 1.0) > sumTolerance(size))
             throw std::invalid_argument("Probabilities must sum to 1");
     }
 
-    // VERY IMPORTANT TO KEEP isSubset() here, since other methods may rely
-    // on the fact that this is checked here!!!
-    double probabilityCalculator(const std::set<T>& event) const {
-        isSubset(event);
-	double total = 0.0;
+    static void validOutcomes(const T* keys, std::size_t size) {
+        if (std::adjacent_find(keys, keys + size, [](const T& a, const T& b){ return !(a < b); }) != keys + size)
+            throw std::invalid_argument("Outcomes must be sorted and unique");
+    }
 
-	for (const auto& outcome : event) {
-	    auto it = space.find(outcome);
-	    bool eventExists = (it != space.end());
-	    if (!ignoreUnknown && !eventExists) {
-	        throw std::invalid_argument("Event contains outcome not in sample space");
-            }
-	    else if (eventExists) {
-	        total += it->second;
-	    }
-	}
+    // Take ownership of validated arrays and point the views at them.
+    void adopt(std::vector<T> keys, std::vector<double> probs) {
+        validProbabilitySpace(probs.data(), probs.size());
+        adoptUnchecked(std::move(keys), std::move(probs));
+    }
 
-	return total;
+    void adoptUnchecked(std::vector<T> keys, std::vector<double> probs) {
+        auto owned = std::make_shared<Storage>();
+        owned->cumulative = buildCumulative(probs.data(), probs.size());
+        owned->outcomes = std::move(keys);
+        owned->probabilities = std::move(probs);
+        PROBABILITY_ENGINE_COUNT_BYTES(owned->outcomes.capacity() * sizeof(T) +
+                                       (owned->probabilities.capacity() + owned->cumulative.capacity()) * sizeof(double));
+        outcomes = ArrayView<T>(owned->outcomes.data(), owned->outcomes.size());
+        probabilities = ArrayView<double>(owned->probabilities.data(), owned->probabilities.size());
+        cumulative = ArrayView<double>(owned->cumulative.data(), owned->cumulative.size());
+        indexKeys(*owned);
+        storage = std::move(owned);
     }
 
-    // No need to check subset, since it is handled in probabilityCalculator
-    double complement(const std::set<T>& event) const {
-        return 1.0 - probabilityCalculator(event);
+    // The posterior for likelihood[i] of every outcome. Products and their total
+    // are formed in one pass with four accumulators so the loop vectorizes, the
+    // posterior shares the outcomes and key index of this space and nothing but
+    // its probabilities and prefix sums is allocated.
+    ProbabilitySpace posterior(const double* likelihood) const {
+        std::size_t n = probabilities.size();
+        std::vector<double> probs(n);
+        double lanes[4] = {0.0, 0.0, 0.0, 0.0};
+        bool valid = true;
+        for (std::size_t i = 0; i < n; ++i) {
+            valid &= likelihood[i] >= 0.0 && likelihood[i] <= std::numeric_limits<double>::max();
+            probs[i] = probabilities[i] * likelihood[i];
+            lanes[i % 4] += probs[i];
+        }
+        if (!valid) throw std::invalid_argument("Likelihoods must be nonnegative and finite");
+        double evidence = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        if (!(evidence > 0.0))
+            throw std::invalid_argument("Observation has probability 0 under the prior");
+        if (!std::isfinite(evidence))
+            throw std::invalid_argument("Likelihoods are too large to normalize");
+        double scale = 1.0 / evidence;
+        for (std::size_t i = 0; i < n; ++i) probs[i] *= scale;
+
+        ProbabilitySpace result(*this);
+        auto updated = std::make_shared<Storage>();
+        updated->cumulative = buildCumulative(probs.data(), n);
+        updated->probabilities = std::move(probs);
+        updated->external = storage;
+        PROBABILITY_ENGINE_COUNT_BYTES((updated->probabilities.capacity() + updated->cumulative.capacity()) * sizeof(double));
+        result.probabilities = ArrayView<double>(updated->probabilities.data(), n);
+        result.cumulative = ArrayView<double>(updated->cumulative.data(), updated->cumulative.size());
+        result.storage = std::move(updated);
+        return result;
     }
 
-    double unionEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
-        isSubset(eventA);
-	isSubset(eventB);
-	std::set<T> unioned;
-	
-	std::set_union(
-            eventA.begin(), eventA.end(),
-	    eventB.begin(), eventB.end(),
-	    std::inserter(unioned, unioned.begin())
-        );
+    // Adopt sorted arrays that are a distribution by construction, such as the
+    // tables generated by DiscreteDistribution. Nothing is checked.
+    struct TrustedTag {};
+
+    ProbabilitySpace(TrustedTag, std::vector<T> keys, std::vector<double> probs) {
+        adoptUnchecked(std::move(keys), std::move(probs));
+    }
 
-	return probabilityCalculator(unioned);
+    // View arrays that were validated and summed before, e.g. by the writer of a
+    // memory-mapped file. Nothing is checked and nothing is allocated besides
+    // the storage block holding the owner and the key index.
+    ProbabilitySpace(const T* keys, const double* probs, const double* sums, std::size_t size,
+                     std::shared_ptr<const void> owner) {
+        auto viewed = std::make_shared<Storage>();
+        viewed->external = std::move(owner);
+        outcomes = ArrayView<T>(keys, size);
+        probabilities = ArrayView<double>(probs, size);
+        cumulative = ArrayView<double>(sums, size + 1);
+        indexKeys(*viewed);
+        storage = std::move(viewed);
     }
 
-    double intersectionEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
-        isSubset(eventA);
-	isSubset(eventB);
-	std::set<T> intersected;
+    // The kernels below validate every outcome in the same walk that uses it
+    // and report unknown outcomes through the result instead of throwing.
+    // Outcomes missing from the sample space are skipped if ignore is set.
 
-	std::set_intersection(
-            eventA.begin(), eventA.end(),
-	    eventB.begin(), eventB.end(),
-	    std::inserter(intersected, intersected.begin())
-        );
+    template <typename It>
+    QueryResult probabilityCalculator(It first, It last, bool ignore) const {
+        Accumulator total;
+        std::size_t pos = 0;
 
-	return probabilityCalculator(intersected);
+        for (; first != last; ++first) {
+            if (locate(*first, pos)) total.add(probabilities[pos]);
+            else if (!ignore) return {0.0, QueryError::UnknownOutcome};
+        }
+
+        return {total.result(), QueryError::None};
     }
 
-    // Calculate P(A|B), throw exception if P(B)=0
-    double _conditionalProbability(const std::set<T>& eventA, const std::set<T>& eventB) const {
-        isSubset(eventA);
-        isSubset(eventB);
-        double probB = probabilityCalculator(eventB);
-        if (probB != 0) {
-            double prob_AnB = intersectionEvents(eventA, eventB);
-            return prob_AnB/probB;
-	} else {
-            throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
-	}
-        
+    template <typename It>
+    QueryResult complement(It first, It last, bool ignore) const {
+        QueryResult result = probabilityCalculator(first, last, ignore);
+        result.probability = 1.0 - result.probability;
+        return result;
     }
 
-public:
+    // Walk both sorted events together and sum every outcome of either one
+    // exactly once, without materializing the union.
+    template <typename ItA, typename ItB>
+    QueryResult unionEvents(ItA firstA, ItA lastA, ItB firstB, ItB lastB, bool ignore) const {
+        Accumulator total;
+        std::size_t pos = 0;
+
+        while (firstA != lastA || firstB != lastB) {
+            const T* outcome;
+            if (firstB == lastB || (firstA != lastA && *firstA < *firstB)) {
+                outcome = &*firstA++;
+            }
+            else if (firstA == lastA || *firstB < *firstA) {
+                outcome = &*firstB++;
+            }
+            else {
+                outcome = &*firstA++;
+                ++firstB;
+            }
+            if (locate(*outcome, pos)) total.add(probabilities[pos]);
+            else if (!ignore) return {0.0, QueryError::UnknownOutcome};
+        }
+
+        return {total.result(), QueryError::None};
+    }
 
     /**
-     * @brief Construct a probability space from a given mapping P: W -> [0,1]. 
+     * @brief Walk both sorted events together, validating every outcome once.
      *
-     * @param mapping A mapping P: W -> [0,1] representing all possible singular events in the sample space W
-     * and their corresponding probabilities.
-     * @throws std::invalid_argumenet if the mapping contains negative probabilities or the probabilites don't
-     * sum up to one.
+     * @param probB Receives P(B).
+     * @return P(A n B).
      */
-    ProbabilitySpace(std::map<T, double> mapping) {
-        validProbabilitySpace(mapping);
-	events = getKeys(mapping);
-        space = std::move(mapping);
+    template <typename ItA, typename ItB>
+    QueryResult intersectionWalk(ItA firstA, ItA lastA, ItB firstB, ItB lastB, bool ignore, double& probB) const {
+        Accumulator total;
+        Accumulator sumB;
+        std::size_t pos = 0;
+        probB = 0.0;
+
+        while (firstA != lastA || firstB != lastB) {
+            bool inA = firstB == lastB || (firstA != lastA && !(*firstB < *firstA));
+            bool inB = firstA == lastA || (firstB != lastB && !(*firstA < *firstB));
+            const T& outcome = inA ? *firstA : *firstB;
+            if (locate(outcome, pos)) {
+                if (inB) sumB.add(probabilities[pos]);
+                if (inA && inB) total.add(probabilities[pos]);
+            }
+            else if (!ignore) {
+                return {0.0, QueryError::UnknownOutcome};
+            }
+            if (inA) ++firstA;
+            if (inB) ++firstB;
+        }
+
+        probB = sumB.result();
+        return {total.result(), QueryError::None};
     }
 
-    double probabilityOfSet(const std::set<T>& event) const {
-        return probabilityCalculator(event);
+    template <typename ItA, typename ItB>
+    QueryResult intersectionEvents(ItA firstA, ItA lastA, ItB firstB, ItB lastB, bool ignore) const {
+        double probB;
+        return intersectionWalk(firstA, lastA, firstB, lastB, ignore, probB);
     }
 
-    double complementOfEvent(const std::set<T>& event) const {
-        return complement(event);
+    // Calculate P(A|B), report an error if P(B)=0
+    template <typename ItA, typename ItB>
+    QueryResult _conditionalProbability(ItA firstA, ItA lastA, ItB firstB, ItB lastB, bool ignore) const {
+        double probB;
+        QueryResult result = intersectionWalk(firstA, lastA, firstB, lastB, ignore, probB);
+        if (!result.ok()) return result;
+        if (probB == 0) return {0.0, QueryError::ZeroProbabilityCondition};
+        return {result.probability/probB, QueryError::None};
     }
 
-    double unionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
-        return unionEvents(eventA, eventB); 
+    /**
+     * @brief Calculate P(A n B) for a condition B that has already been validated.
+     *
+     * @param indicesB Sorted positions of the outcomes of B in the dense storage.
+     */
+    template <typename It, typename Indices>
+    QueryResult conditionedWalk(It first, It last, const Indices& indicesB, bool ignore) const {
+        Accumulator total;
+        std::size_t pos = 0;
+        std::size_t j = 0;
+
+        for (; first != last; ++first) {
+            if (locate(*first, pos)) {
+                while (j < indicesB.size() && indicesB[j] < pos) ++j;
+                if (j < indicesB.size() && indicesB[j] == pos) total.add(probabilities[pos]);
+            }
+            else if (!ignore) {
+                return {0.0, QueryError::UnknownOutcome};
+            }
+        }
+
+        return {total.result(), QueryError::None};
     }
 
-    double intersectionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
-        return intersectionEvents(eventA, eventB);
+    // Collect the positions of the outcomes of an event into indices.
+    template <typename It, typename Indices>
+    QueryError indexWalk(It first, It last, bool ignore, Indices& indices) const {
+        indices.clear();
+        std::size_t pos = 0;
+
+        for (; first != last; ++first) {
+            if (locate(*first, pos)) indices.push_back(pos);
+            else if (!ignore) return QueryError::UnknownOutcome;
+        }
+
+        return QueryError::None;
     }
 
-    double conditionalProbability(const std::set<T>& eventA, const std::set<T>& eventB) const {
-        return _conditionalProbability(eventA, eventB);
+    // Unchecked kernels over validated events. The indices are sorted and
+    // known to be in range, so no outcome is compared or looked up.
+
+    template <typename Indices>
+    double indexCalculator(const Indices& indices) const {
+        Accumulator total;
+        for (auto i : indices) total.add(probabilities[i]);
+        return total.result();
     }
 
-    bool getCurrentMode() const {
-        return ignoreUnknown;
+    double indexUnion(const std::vector<std::size_t>& a, const std::vector<std::size_t>& b) const {
+        Accumulator total;
+        std::size_t i = 0, j = 0;
+        while (i < a.size() && j < b.size()) {
+            if (a[i] < b[j]) total.add(probabilities[a[i++]]);
+            else if (b[j] < a[i]) total.add(probabilities[b[j++]]);
+            else { total.add(probabilities[a[i]]); ++i; ++j; }
+        }
+        for (; i < a.size(); ++i) total.add(probabilities[a[i]]);
+        for (; j < b.size(); ++j) total.add(probabilities[b[j]]);
+        return total.result();
     }
 
-    void setIgnoreUnknown(bool mode) {
-        ignoreUnknown = mode;
+    double indexIntersection(const std::vector<std::size_t>& a, const std::vector<std::size_t>& b) const {
+        Accumulator total;
+        std::size_t i = 0, j = 0;
+        while (i < a.size() && j < b.size()) {
+            if (a[i] < b[j]) ++i;
+            else if (b[j] < a[i]) ++j;
+            else { total.add(probabilities[a[i]]); ++i; ++j; }
+        }
+        return total.result();
+    }
+
+    bool belongs(const ValidatedEvent<T>& event) const noexcept {
+        return event.owner == outcomes.data() && event.spaceSize == outcomes.size();
+    }
+
+    void isSameSpace(const ValidatedEvent<T>& event) const {
+        if (!belongs(event))
+            throw std::invalid_argument("Validated event does not belong to this sample space");
+    }
+
+    template <typename It>
+    ValidatedEvent<T> validated(It first, It last) const {
+        std::vector<std::size_t> indices;
+        if (indexWalk(first, last, ignoreUnknown, indices) != QueryError::None)
+            valueOf({0.0, QueryError::UnknownOutcome});
+        PROBABILITY_ENGINE_COUNT_BYTES(indices.capacity() * sizeof(std::size_t));
+        return ValidatedEvent<T>(std::move(indices), outcomes.data(), outcomes.size());
+    }
+
+    // A condition B validated once for a batch of conditional queries. The
+    // indices live in the given memory resource, usually the scratch arena.
+    struct ConditionScratch {
+        std::pmr::vector<std::size_t> indices;
+        double probability = 0.0;
+        QueryError error = QueryError::None;
+
+        explicit ConditionScratch(std::pmr::memory_resource* resource) : indices(resource) {}
+    };
+
+    // Validate B into the given scratch, reusing its buffer.
+    void conditionOf(const std::set<T>& eventB, bool ignore, ConditionScratch& condition) const {
+        condition.error = indexWalk(eventB.begin(), eventB.end(), ignore, condition.indices);
+        condition.probability = indexCalculator(condition.indices);
+    }
+
+    ConditionScratch conditionOf(const std::set<T>& eventB, bool ignore, std::pmr::memory_resource* resource) const {
+        ConditionScratch condition(resource);
+        conditionOf(eventB, ignore, condition);
+        return condition;
+    }
+
+    QueryResult conditionedQuery(const std::set<T>& eventA, const ConditionScratch& condition, bool ignore) const {
+        QueryResult result = conditionedWalk(eventA.begin(), eventA.end(), condition.indices, ignore);
+        if (!result.ok()) return result;
+        if (condition.error != QueryError::None) return {0.0, condition.error};
+        if (condition.probability == 0) return {0.0, QueryError::ZeroProbabilityCondition};
+        return {result.probability/condition.probability, QueryError::None};
+    }
+
+    void isSameSpace(const EventMask& mask) const {
+        if (mask.size() != outcomes.size())
+            throw std::invalid_argument("Event mask does not belong to this sample space");
+    }
+
+    template <typename E>
+    void isSameSpace(const EventExpression<E>& event) const {
+        if (event.self().size() != outcomes.size())
+            throw std::invalid_argument("Event mask does not belong to this sample space");
+    }
+
+    // Add the probabilities of the outcomes set in word w of an event in
+    // ascending index order, so that sums match probabilityCalculator() for
+    // the same event. Full words are summed as a contiguous run.
+    void addWord(Accumulator& total, std::uint64_t word, std::size_t w) const {
+        const double* block = probabilities.data() + w * 64;
+        if (word == ~std::uint64_t{0}) {
+            for (std::size_t b = 0; b < 64; ++b) total.add(block[b]);
+        }
+        else {
+            while (word != 0) {
+                total.add(block[__builtin_ctzll(word)]);
+                word &= word - 1;
+            }
+        }
+    }
+
+    // Sum the probabilities of the outcomes in the mask, skipping empty words
+    double maskCalculator(const EventMask& mask) const {
+        isSameSpace(mask);
+        const auto& words = mask.data();
+        Accumulator total;
+        for (std::size_t w = 0; w < words.size(); ++w) {
+            if (words[w] != 0) addWord(total, words[w], w);
+        }
+        return total.result();
+    }
+
+    // Evaluate an expression word by word while summing it
+    template <typename E>
+    double expressionCalculator(const E& event) const {
+        std::size_t words = (outcomes.size() + 63) / 64;
+        Accumulator total;
+        for (std::size_t w = 0; w < words; ++w) {
+            std::uint64_t word = event.word(w);
+            if (word != 0) addWord(total, word, w);
+        }
+        return total.result();
     }
 
+public:
+
+    /**
+     * @brief Construct a probability space from a given mapping P: W -> [0,1]. 
+     *
+     * @param mapping A mapping P: W -> [0,1] representing all possible singular events in the sample space W
+     * and their corresponding probabilities.
+     * @throws std::invalid_argumenet if the mapping contains negative probabilities or the probabilites don't
+     * sum up to one.
+     */
+    ProbabilitySpace(std::map<T, double> mapping) {
+        std::vector<T> keys;
+        std::vector<double> probs;
+        keys.reserve(mapping.size());
+        probs.reserve(mapping.size());
+        // Extracting the nodes lets the keys be moved out instead of copied
+        // and releases the tree as the dense arrays grow.
+        while (!mapping.empty()) {
+            auto node = mapping.extract(mapping.begin());
+            keys.push_back(std::move(node.key()));
+            probs.push_back(node.mapped());
+        }
+        adopt(std::move(keys), std::move(probs));
+    }
+
+    /**
+     * @brief View a space with another summation policy.
+     *
+     * The arrays of the other space are shared, its key index included, so nothing
+     * is copied, indexed or validated again. KeyIndex is the same enumeration in every
+     * specialization, only as a distinct type.
+     */
+    template <typename OtherSum>
+    explicit ProbabilitySpace(const ProbabilitySpace<T, OtherSum>& other)
+        : outcomes(other.outcomes), probabilities(other.probabilities), cumulative(other.cumulative),
+          keyIndex(static_cast<KeyIndex>(static_cast<unsigned char>(other.keyIndex))), lowerBounds(other.lowerBounds), ignoreUnknown(other.ignoreUnknown) {
+        auto shared = std::make_shared<Storage>();
+        shared->external = other.storage;
+        storage = std::move(shared);
+    }
+
+    /**
+     * @brief Construct a probability space from a list of outcomes and their probabilities.
+     *
+     * The list is sorted unless it already is, which is checked in O(n), and the
+     * outcomes are moved out of it without per-outcome allocation.
+     *
+     * @param mapping Pairs of outcomes and their probabilities, in any order.
+     * @throws std::invalid_argument if an outcome appears twice, a probability is negative or
+     * the probabilities don't sum up to one.
+     */
+    explicit ProbabilitySpace(std::vector<std::pair<T, double>> mapping) {
+        auto byOutcome = [](const std::pair<T, double>& a, const std::pair<T, double>& b){ return a.first < b.first; };
+        if (!std::is_sorted(mapping.begin(), mapping.end(), byOutcome))
+            std::sort(mapping.begin(), mapping.end(), byOutcome);
+        std::vector<T> keys;
+        std::vector<double> probs;
+        keys.reserve(mapping.size());
+        probs.reserve(mapping.size());
+        for (auto& [k, v] : mapping) {
+            if (!keys.empty() && !(keys.back() < k)) throw std::invalid_argument("Outcomes must be sorted and unique");
+            keys.push_back(std::move(k));
+            probs.push_back(v);
+        }
+        adopt(std::move(keys), std::move(probs));
+    }
+
+    /**
+     * @brief Construct a probability space from parallel arrays of outcomes and probabilities.
+     *
+     * The arrays are adopted as they are, so construction is a single O(n) validation pass.
+     *
+     * @param keys Outcomes sorted in ascending order without duplicates.
+     * @param probs probs[i] is the probability of keys[i].
+     * @throws std::invalid_argument if the arrays differ in size, the outcomes are not sorted
+     * and unique, a probability is negative or the probabilities don't sum up to one.
+     */
+    ProbabilitySpace(SortedUniqueTag, std::vector<T> keys, std::vector<double> probs) {
+        if (keys.size() != probs.size())
+            throw std::invalid_argument("Every outcome needs exactly one probability");
+        validOutcomes(keys.data(), keys.size());
+        adopt(std::move(keys), std::move(probs));
+    }
+
+    /**
+     * @brief Construct a probability space that views caller-owned arrays without copying them.
+     *
+     * Only the prefix sums are allocated. The arrays must stay alive and unchanged for as
+     * long as the space or any of its copies exist; passing an owner handle makes the
+     * space keep them alive itself.
+     *
+     * @param keys Outcomes sorted in ascending order without duplicates.
+     * @param probs probs[i] is the probability of keys[i].
+     * @param size Number of outcomes.
+     * @param owner Optional handle keeping the arrays alive.
+     * @throws std::invalid_argument if the outcomes are not sorted and unique, a probability
+     * is negative or the probabilities don't sum up to one.
+     */
+    ProbabilitySpace(SortedUniqueTag, const T* keys, const double* probs, std::size_t size,
+                     std::shared_ptr<const void> owner = nullptr) {
+        validOutcomes(keys, size);
+        validProbabilitySpace(probs, size);
+        auto viewed = std::make_shared<Storage>();
+        viewed->cumulative = buildCumulative(probs, size);
+        PROBABILITY_ENGINE_COUNT_BYTES(viewed->cumulative.capacity() * sizeof(double));
+        viewed->external = std::move(owner);
+        outcomes = ArrayView<T>(keys, size);
+        probabilities = ArrayView<double>(probs, size);
+        cumulative = ArrayView<double>(viewed->cumulative.data(), viewed->cumulative.size());
+        indexKeys(*viewed);
+        storage = std::move(viewed);
+    }
+
+    double probabilityOfSet(const std::set<T>& event) const {
+        return unwrap(tryProbabilityOfSet(event));
+    }
+
+    double complementOfEvent(const std::set<T>& event) const {
+        return unwrap(tryComplementOfEvent(event));
+    }
+
+    double unionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        return unwrap(tryUnionOfEvents(eventA, eventB));
+    }
+
+    double intersectionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        return unwrap(tryIntersectionOfEvents(eventA, eventB));
+    }
+
+    double conditionalProbability(const std::set<T>& eventA, const std::set<T>& eventB) const {
+        return unwrap(tryConditionalProbability(eventA, eventB));
+    }
+
+    /**
+     * @brief Calculate the probability of an event given as a range of outcomes.
+     *
+     * The range overloads let callers holding events in other containers, such as
+     * a sorted std::vector<T>, query the space without building a std::set first.
+     *
+     * @param first, last A range of outcomes sorted in ascending order without duplicates.
+     * @return The probability of the event.
+     * @throws std::invalid_argument if the range is not sorted and unique, or contains an
+     * outcome not in the sample space.
+     */
+    template <typename It, typename = EnableIfOutcomeIterator<It>>
+    double probabilityOfSet(It first, It last) const {
+        return unwrap(tryProbabilityOfSet(first, last));
+    }
+
+    template <typename It, typename = EnableIfOutcomeIterator<It>>
+    double complementOfEvent(It first, It last) const {
+        return unwrap(tryComplementOfEvent(first, last));
+    }
+
+    template <typename ItA, typename ItB, typename = EnableIfOutcomeIterator<ItA>, typename = EnableIfOutcomeIterator<ItB>>
+    double unionOfEvents(ItA firstA, ItA lastA, ItB firstB, ItB lastB) const {
+        return unwrap(tryUnionOfEvents(firstA, lastA, firstB, lastB));
+    }
+
+    template <typename ItA, typename ItB, typename = EnableIfOutcomeIterator<ItA>, typename = EnableIfOutcomeIterator<ItB>>
+    double intersectionOfEvents(ItA firstA, ItA lastA, ItB firstB, ItB lastB) const {
+        return unwrap(tryIntersectionOfEvents(firstA, lastA, firstB, lastB));
+    }
+
+    template <typename ItA, typename ItB, typename = EnableIfOutcomeIterator<ItA>, typename = EnableIfOutcomeIterator<ItB>>
+    double conditionalProbability(ItA firstA, ItA lastA, ItB firstB, ItB lastB) const {
+        return unwrap(tryConditionalProbability(firstA, lastA, firstB, lastB));
+    }
+
+    /**
+     * @brief Validate an event once, so that later queries on it skip all checks.
+     *
+     * @param event A set of outcomes.
+     * @return A handle to the event that can only be used with this space. Outcomes not
+     * in the sample space are dropped if unknown outcomes are ignored.
+     * @throws std::invalid_argument if the event contains an outcome not in the sample space.
+     */
+    ValidatedEvent<T> validate(const std::set<T>& event) const {
+        return validated(event.begin(), event.end());
+    }
+
+    template <typename It, typename = EnableIfOutcomeIterator<It>>
+    ValidatedEvent<T> validate(It first, It last) const {
+        isSortedEvent(first, last);
+        return validated(first, last);
+    }
+
+    /**
+     * @brief Validate an event given by the positions of its outcomes in the dense storage.
+     *
+     * Positions are the natural IDs of outcomes, e.g. the ones handed out by a
+     * SymbolTable. No outcome is compared, only the positions are checked.
+     *
+     * @param indices Positions in [0, size()) in any order. Duplicates are dropped.
+     * @throws std::invalid_argument if a position is not in the sample space.
+     */
+    ValidatedEvent<T> validateIndices(std::vector<std::size_t> indices) const {
+        std::sort(indices.begin(), indices.end());
+        indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+        if (!indices.empty() && indices.back() >= outcomes.size())
+            valueOf({0.0, QueryError::UnknownOutcome});
+        PROBABILITY_ENGINE_COUNT_BYTES(indices.capacity() * sizeof(std::size_t));
+        return ValidatedEvent<T>(std::move(indices), outcomes.data(), outcomes.size());
+    }
+
+    double probabilityOfSet(const ValidatedEvent<T>& event) const {
+        return unwrap(tryProbabilityOfSet(event));
+    }
+
+    double complementOfEvent(const ValidatedEvent<T>& event) const {
+        return unwrap(tryComplementOfEvent(event));
+    }
+
+    double unionOfEvents(const ValidatedEvent<T>& eventA, const ValidatedEvent<T>& eventB) const {
+        return unwrap(tryUnionOfEvents(eventA, eventB));
+    }
+
+    double intersectionOfEvents(const ValidatedEvent<T>& eventA, const ValidatedEvent<T>& eventB) const {
+        return unwrap(tryIntersectionOfEvents(eventA, eventB));
+    }
+
+    double conditionalProbability(const ValidatedEvent<T>& eventA, const ValidatedEvent<T>& eventB) const {
+        return unwrap(tryConditionalProbability(eventA, eventB));
+    }
+
+    /**
+     * @brief Calculate the probability of a validated event on the threads of an executor.
+     *
+     * The blocks of the sum are spread over the threads and merged in order, so the
+     * result is bit for bit the one of probabilityOfSet(event) for any number of threads.
+     *
+     * @throws std::invalid_argument if the event belongs to another space.
+     */
+    double probabilityOfSet(const ValidatedEvent<T>& event, WorkStealingExecutor& executor) const {
+        isSameSpace(event);
+        PROBABILITY_ENGINE_TIME_QUERY(Probability, event.size());
+        const double* probs = probabilities.data();
+        const std::size_t* indices = event.indices.data();
+        return reproducibleSum<Sum>(event.size(), [&](std::size_t i){ return probs[indices[i]]; }, executor);
+    }
+
+    /**
+     * @brief Calculate the probability of an event without throwing.
+     *
+     * The try* queries are the non-throwing counterparts of the queries above, which
+     * are thin wrappers around them. Failures come back in the error field of the
+     * result, so rejecting an invalid query from a client is a branch on the result
+     * instead of an unwind.
+     *
+     * @param event A set of outcomes.
+     * @return The probability of the event, or the reason the query failed.
+     */
+    QueryResult tryProbabilityOfSet(const std::set<T>& event) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Probability, event.size());
+        return counted(probabilityCalculator(event.begin(), event.end(), ignoreUnknown));
+    }
+
+    QueryResult tryComplementOfEvent(const std::set<T>& event) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Complement, event.size());
+        return counted(complement(event.begin(), event.end(), ignoreUnknown));
+    }
+
+    QueryResult tryUnionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Union, eventA.size(), eventB.size());
+        return counted(unionEvents(eventA.begin(), eventA.end(), eventB.begin(), eventB.end(), ignoreUnknown));
+    }
+
+    QueryResult tryIntersectionOfEvents(const std::set<T>& eventA, const std::set<T>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Intersection, eventA.size(), eventB.size());
+        return counted(intersectionEvents(eventA.begin(), eventA.end(), eventB.begin(), eventB.end(), ignoreUnknown));
+    }
+
+    QueryResult tryConditionalProbability(const std::set<T>& eventA, const std::set<T>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Conditional, eventA.size(), eventB.size());
+        return counted(_conditionalProbability(eventA.begin(), eventA.end(), eventB.begin(), eventB.end(), ignoreUnknown));
+    }
+
+    // Ranges that are not sorted and unique fail with QueryError::UnsortedEvent.
+    template <typename It, typename = EnableIfOutcomeIterator<It>>
+    QueryResult tryProbabilityOfSet(It first, It last) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Probability, static_cast<std::size_t>(std::distance(first, last)));
+        if (!sortedEvent(first, last)) return counted({0.0, QueryError::UnsortedEvent});
+        return counted(probabilityCalculator(first, last, ignoreUnknown));
+    }
+
+    template <typename It, typename = EnableIfOutcomeIterator<It>>
+    QueryResult tryComplementOfEvent(It first, It last) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Complement, static_cast<std::size_t>(std::distance(first, last)));
+        if (!sortedEvent(first, last)) return counted({0.0, QueryError::UnsortedEvent});
+        return counted(complement(first, last, ignoreUnknown));
+    }
+
+    template <typename ItA, typename ItB, typename = EnableIfOutcomeIterator<ItA>, typename = EnableIfOutcomeIterator<ItB>>
+    QueryResult tryUnionOfEvents(ItA firstA, ItA lastA, ItB firstB, ItB lastB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Union, static_cast<std::size_t>(std::distance(firstA, lastA)), static_cast<std::size_t>(std::distance(firstB, lastB)));
+        if (!sortedEvent(firstA, lastA) || !sortedEvent(firstB, lastB)) return counted({0.0, QueryError::UnsortedEvent});
+        return counted(unionEvents(firstA, lastA, firstB, lastB, ignoreUnknown));
+    }
+
+    template <typename ItA, typename ItB, typename = EnableIfOutcomeIterator<ItA>, typename = EnableIfOutcomeIterator<ItB>>
+    QueryResult tryIntersectionOfEvents(ItA firstA, ItA lastA, ItB firstB, ItB lastB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Intersection, static_cast<std::size_t>(std::distance(firstA, lastA)), static_cast<std::size_t>(std::distance(firstB, lastB)));
+        if (!sortedEvent(firstA, lastA) || !sortedEvent(firstB, lastB)) return counted({0.0, QueryError::UnsortedEvent});
+        return counted(intersectionEvents(firstA, lastA, firstB, lastB, ignoreUnknown));
+    }
+
+    template <typename ItA, typename ItB, typename = EnableIfOutcomeIterator<ItA>, typename = EnableIfOutcomeIterator<ItB>>
+    QueryResult tryConditionalProbability(ItA firstA, ItA lastA, ItB firstB, ItB lastB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Conditional, static_cast<std::size_t>(std::distance(firstA, lastA)), static_cast<std::size_t>(std::distance(firstB, lastB)));
+        if (!sortedEvent(firstA, lastA) || !sortedEvent(firstB, lastB)) return counted({0.0, QueryError::UnsortedEvent});
+        return counted(_conditionalProbability(firstA, lastA, firstB, lastB, ignoreUnknown));
+    }
+
+    // Events validated by another space fail with QueryError::ForeignEvent.
+    QueryResult tryProbabilityOfSet(const ValidatedEvent<T>& event) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Probability, event.size());
+        if (!belongs(event)) return counted({0.0, QueryError::ForeignEvent});
+        return {indexCalculator(event.indices), QueryError::None};
+    }
+
+    QueryResult tryComplementOfEvent(const ValidatedEvent<T>& event) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Complement, event.size());
+        if (!belongs(event)) return counted({0.0, QueryError::ForeignEvent});
+        return {1.0 - indexCalculator(event.indices), QueryError::None};
+    }
+
+    QueryResult tryUnionOfEvents(const ValidatedEvent<T>& eventA, const ValidatedEvent<T>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Union, eventA.size(), eventB.size());
+        if (!belongs(eventA) || !belongs(eventB)) return counted({0.0, QueryError::ForeignEvent});
+        return {indexUnion(eventA.indices, eventB.indices), QueryError::None};
+    }
+
+    QueryResult tryIntersectionOfEvents(const ValidatedEvent<T>& eventA, const ValidatedEvent<T>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Intersection, eventA.size(), eventB.size());
+        if (!belongs(eventA) || !belongs(eventB)) return counted({0.0, QueryError::ForeignEvent});
+        return {indexIntersection(eventA.indices, eventB.indices), QueryError::None};
+    }
+
+    QueryResult tryConditionalProbability(const ValidatedEvent<T>& eventA, const ValidatedEvent<T>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Conditional, eventA.size(), eventB.size());
+        if (!belongs(eventA) || !belongs(eventB)) return counted({0.0, QueryError::ForeignEvent});
+        double probB = indexCalculator(eventB.indices);
+        if (probB == 0) return counted({0.0, QueryError::ZeroProbabilityCondition});
+        return {indexIntersection(eventA.indices, eventB.indices)/probB, QueryError::None};
+    }
+
+    /**
+     * @brief Calculate the probability of an event held in a set with its own allocator.
+     *
+     * The overloads for std::set<T, std::less<T>, Alloc> let clients build events in a
+     * memory resource of their own, e.g. a std::pmr::set<T> over a per-request
+     * std::pmr::monotonic_buffer_resource, so that building and dropping events never
+     * touches the global heap. They behave exactly like the std::set<T> overloads.
+     */
+    template <typename Alloc>
+    QueryResult tryProbabilityOfSet(const std::set<T, std::less<T>, Alloc>& event) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Probability, event.size());
+        return counted(probabilityCalculator(event.begin(), event.end(), ignoreUnknown));
+    }
+
+    template <typename Alloc>
+    QueryResult tryComplementOfEvent(const std::set<T, std::less<T>, Alloc>& event) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Complement, event.size());
+        return counted(complement(event.begin(), event.end(), ignoreUnknown));
+    }
+
+    template <typename AllocA, typename AllocB>
+    QueryResult tryUnionOfEvents(const std::set<T, std::less<T>, AllocA>& eventA,
+                                 const std::set<T, std::less<T>, AllocB>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Union, eventA.size(), eventB.size());
+        return counted(unionEvents(eventA.begin(), eventA.end(), eventB.begin(), eventB.end(), ignoreUnknown));
+    }
+
+    template <typename AllocA, typename AllocB>
+    QueryResult tryIntersectionOfEvents(const std::set<T, std::less<T>, AllocA>& eventA,
+                                        const std::set<T, std::less<T>, AllocB>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Intersection, eventA.size(), eventB.size());
+        return counted(intersectionEvents(eventA.begin(), eventA.end(), eventB.begin(), eventB.end(), ignoreUnknown));
+    }
+
+    template <typename AllocA, typename AllocB>
+    QueryResult tryConditionalProbability(const std::set<T, std::less<T>, AllocA>& eventA,
+                                          const std::set<T, std::less<T>, AllocB>& eventB) const noexcept {
+        PROBABILITY_ENGINE_TIME_QUERY(Conditional, eventA.size(), eventB.size());
+        return counted(_conditionalProbability(eventA.begin(), eventA.end(), eventB.begin(), eventB.end(), ignoreUnknown));
+    }
+
+    template <typename Alloc>
+    double probabilityOfSet(const std::set<T, std::less<T>, Alloc>& event) const {
+        return unwrap(tryProbabilityOfSet(event));
+    }
+
+    template <typename Alloc>
+    double complementOfEvent(const std::set<T, std::less<T>, Alloc>& event) const {
+        return unwrap(tryComplementOfEvent(event));
+    }
+
+    template <typename AllocA, typename AllocB>
+    double unionOfEvents(const std::set<T, std::less<T>, AllocA>& eventA, const std::set<T, std::less<T>, AllocB>& eventB) const {
+        return unwrap(tryUnionOfEvents(eventA, eventB));
+    }
+
+    template <typename AllocA, typename AllocB>
+    double intersectionOfEvents(const std::set<T, std::less<T>, AllocA>& eventA, const std::set<T, std::less<T>, AllocB>& eventB) const {
+        return unwrap(tryIntersectionOfEvents(eventA, eventB));
+    }
+
+    template <typename AllocA, typename AllocB>
+    double conditionalProbability(const std::set<T, std::less<T>, AllocA>& eventA, const std::set<T, std::less<T>, AllocB>& eventB) const {
+        return unwrap(tryConditionalProbability(eventA, eventB));
+    }
+
+    template <typename Alloc>
+    ValidatedEvent<T> validate(const std::set<T, std::less<T>, Alloc>& event) const {
+        return validated(event.begin(), event.end());
+    }
+
+    /**
+     * @brief Condition the space on an event B once, for many queries P(.|B).
+     *
+     * @param eventB The condition. Outcomes not in the sample space are dropped if
+     * unknown outcomes are ignored.
+     * @return A view sharing the storage of the space that holds the outcomes of B
+     * and 1/P(B).
+     * @throws std::invalid_argument if B contains an outcome not in the sample space
+     * or P(B)=0.
+     */
+    ConditionedSpace<T, Sum> conditionOn(const std::set<T>& eventB) const {
+        std::vector<std::size_t> indices;
+        if (indexWalk(eventB.begin(), eventB.end(), ignoreUnknown, indices) != QueryError::None)
+            valueOf({0.0, QueryError::UnknownOutcome});
+        return ConditionedSpace<T, Sum>(*this, std::move(indices));
+    }
+
+    template <typename Alloc>
+    ConditionedSpace<T, Sum> conditionOn(const std::set<T, std::less<T>, Alloc>& eventB) const {
+        std::vector<std::size_t> indices;
+        if (indexWalk(eventB.begin(), eventB.end(), ignoreUnknown, indices) != QueryError::None)
+            valueOf({0.0, QueryError::UnknownOutcome});
+        return ConditionedSpace<T, Sum>(*this, std::move(indices));
+    }
+
+    ConditionedSpace<T, Sum> conditionOn(const ValidatedEvent<T>& eventB) const {
+        isSameSpace(eventB);
+        return ConditionedSpace<T, Sum>(*this, eventB.indices);
+    }
+
+    /**
+     * @brief Update the space as a prior by an observation.
+     *
+     * Calculates P(x | obs) = P(x) L(x) / sum_y P(y) L(y) in one multiply-and-sum
+     * pass over the dense probabilities and one scaling pass. The posterior shares
+     * the outcomes of this space, so it costs neither a construction nor a validation.
+     *
+     * @param likelihood likelihood[i] is the likelihood of the observation given the
+     * i-th outcome in ascending order, up to a constant factor.
+     * @return The posterior space.
+     * @throws std::invalid_argument if there isn't exactly one nonnegative finite
+     * likelihood per outcome, or the observation has probability 0 under the prior.
+     */
+    ProbabilitySpace bayesUpdate(const std::vector<double>& likelihood) const {
+        if (likelihood.size() != outcomes.size())
+            throw std::invalid_argument("Every outcome needs exactly one likelihood");
+        return posterior(likelihood.data());
+    }
+
+    // Update by a likelihood given as a callable mapping an outcome to a double
+    template <typename F, typename = std::enable_if_t<std::is_invocable_r_v<double, F, const T&>>>
+    ProbabilitySpace bayesUpdate(F likelihood) const {
+        std::vector<double> values(outcomes.size());
+        for (std::size_t i = 0; i < values.size(); ++i) values[i] = likelihood(outcomes[i]);
+        return posterior(values.data());
+    }
+
+    /**
+     * @brief Calculate the probability P(lo <= X <= hi) of all outcomes in a closed interval.
+     *
+     * Runs in two binary searches over the ordered outcomes, without building the event.
+     *
+     * @param lo The smallest outcome of the interval.
+     * @param hi The largest outcome of the interval.
+     * @return The probability of the interval, 0 if hi < lo.
+     */
+    double probabilityOfRange(const T& lo, const T& hi) const {
+        if (hi < lo) return 0.0;
+        std::size_t first = lowerBound(lo);
+        std::size_t last = static_cast<std::size_t>(
+            std::upper_bound(outcomes.begin() + first, outcomes.end(), hi) - outcomes.begin());
+        return cumulative[last] - cumulative[first];
+    }
+
+    /**
+     * @brief Calculate the cumulative distribution function P(X <= x).
+     *
+     * @param x Any value comparable with the outcomes, it doesn't need to be in the sample space.
+     */
+    double cumulativeProbability(const T& x) const {
+        auto last = std::upper_bound(outcomes.begin(), outcomes.end(), x) - outcomes.begin();
+        return cumulative[static_cast<std::size_t>(last)];
+    }
+
+    /**
+     * @brief Find the smallest outcome x with P(X <= x) >= p.
+     *
+     * @param p A probability in [0, 1].
+     * @return The p-quantile of the distribution.
+     * @throws std::invalid_argument if p is not in [0, 1].
+     */
+    const T& quantile(double p) const {
+        if (!(p >= 0.0 && p <= 1.0))
+            throw std::invalid_argument("Quantile must be taken of a probability in [0, 1]");
+        auto it = std::lower_bound(cumulative.begin() + 1, cumulative.end(), p);
+        // Rounding can leave the last prefix sum just below 1
+        if (it == cumulative.end()) --it;
+        return outcomes[static_cast<std::size_t>(it - cumulative.begin()) - 1];
+    }
+
+    /**
+     * @brief Build the bitset representation of an event of this sample space.
+     *
+     * @param event A set of outcomes.
+     * @return A mask with the bits of the outcomes in the event set. Outcomes not in
+     * the sample space are dropped if unknown outcomes are ignored.
+     * @throws std::invalid_argument if the event contains an outcome not in the sample space.
+     */
+    EventMask maskOf(const std::set<T>& event) const {
+        EventMask mask(outcomes.size());
+        std::size_t pos = 0;
+
+        for (const auto& outcome : event) {
+            if (locate(outcome, pos)) mask.set(pos);
+            else if (!ignoreUnknown) valueOf({0.0, QueryError::UnknownOutcome});
+        }
+
+        return mask;
+    }
+
+    EventMask maskOf(const ValidatedEvent<T>& event) const {
+        isSameSpace(event);
+        EventMask mask(outcomes.size());
+        for (auto i : event.indices) mask.set(i);
+        return mask;
+    }
+
+    double probabilityOfMask(const EventMask& mask) const {
+        return maskCalculator(mask);
+    }
+
+    /**
+     * @brief Calculate the probability of a lazy event expression.
+     *
+     * The expression is evaluated and summed in one pass over the words of the
+     * sample space, e.g. space.probabilityOfSet(lazy(a) | (lazy(b) & ~space.rangeEvent(1, 3)))
+     * without building any intermediate mask.
+     *
+     * @throws std::invalid_argument if the expression belongs to a space of another size.
+     */
+    template <typename E>
+    double probabilityOfSet(const EventExpression<E>& event) const {
+        isSameSpace(event);
+        PROBABILITY_ENGINE_TIME_QUERY(Probability, outcomes.size());
+        return expressionCalculator(event.self());
+    }
+
+    /**
+     * @brief Calculate P(A|B) for lazy event expressions in one fused pass.
+     *
+     * Every word of B and of A n B is evaluated once and both sums are accumulated
+     * in the same pass.
+     *
+     * @throws std::invalid_argument if an expression belongs to a space of another
+     * size, or P(B)=0.
+     */
+    template <typename A, typename B>
+    double conditionalProbability(const EventExpression<A>& eventA, const EventExpression<B>& eventB) const {
+        isSameSpace(eventA);
+        isSameSpace(eventB);
+        PROBABILITY_ENGINE_TIME_QUERY(Conditional, outcomes.size(), outcomes.size());
+        std::size_t words = (outcomes.size() + 63) / 64;
+        Accumulator total;
+        Accumulator sumB;
+        for (std::size_t w = 0; w < words; ++w) {
+            std::uint64_t wordB = eventB.self().word(w);
+            if (wordB == 0) continue;
+            addWord(sumB, wordB, w);
+            std::uint64_t common = eventA.self().word(w) & wordB;
+            if (common != 0) addWord(total, common, w);
+        }
+        double probB = sumB.result();
+        if (probB == 0) return valueOf({0.0, QueryError::ZeroProbabilityCondition});
+        return total.result()/probB;
+    }
+
+    // Materialize a lazy event expression into a mask
+    template <typename E>
+    EventMask maskOf(const EventExpression<E>& event) const {
+        isSameSpace(event);
+        EventMask mask(outcomes.size());
+        for (std::size_t w = 0; w * 64 < outcomes.size(); ++w) {
+            for (std::uint64_t word = event.self().word(w); word != 0; word &= word - 1)
+                mask.set(w * 64 + static_cast<std::size_t>(__builtin_ctzll(word)));
+        }
+        return mask;
+    }
+
+    /**
+     * @brief The outcomes lo <= x <= hi as a leaf of a lazy event expression.
+     *
+     * @param lo, hi Any values comparable with the outcomes, they don't need to be in the sample space.
+     */
+    RangeTerm rangeEvent(const T& lo, const T& hi) const {
+        if (hi < lo) return RangeTerm(0, 0, outcomes.size());
+        std::size_t first = lowerBound(lo);
+        std::size_t last = static_cast<std::size_t>(
+            std::upper_bound(outcomes.begin() + first, outcomes.end(), hi) - outcomes.begin());
+        return RangeTerm(first, last, outcomes.size());
+    }
+
+    // Calculate P(A|B) for masks, throw exception if P(B)=0
+    double conditionalProbabilityOfMask(const EventMask& maskA, const EventMask& maskB) const {
+        double probB = maskCalculator(maskB);
+        if (probB == 0) return valueOf({0.0, QueryError::ZeroProbabilityCondition});
+        return maskCalculator(maskA & maskB)/probB;
+    }
+
+    /**
+     * @brief Calculate the probabilities of many events in one call.
+     *
+     * Events that fail don't stop the batch and nothing is thrown for them:
+     * each failure is reported in the error field of its own result.
+     *
+     * Events are sorted like the conditions of the pairwise conditional batch, so
+     * identical events are walked once. Walks of different events stay separate:
+     * the walks in sorted order start at nondecreasing outcomes, but they aren't
+     * merged into a single pass over the storage.
+     *
+     * @param events The events to evaluate.
+     * @param ignoreUnknown Whether outcomes not in the sample space are skipped for this
+     * batch. The overloads without it use the mode of the space.
+     * @return One result per event, in the same order as the events.
+     */
+    std::vector<QueryResult> probabilitiesOf(const std::vector<std::set<T>>& events, bool ignoreUnknown) const {
+        ScratchScope scratch;
+        std::pmr::vector<std::size_t> order(events.size(), scratch.resource());
+        for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(),
+                         [&](std::size_t a, std::size_t b){ return events[a] < events[b]; });
+
+        std::vector<QueryResult> results(events.size());
+        for (std::size_t first = 0; first < order.size();) {
+            const std::set<T>& event = events[order[first]];
+            QueryResult result = probabilityCalculator(event.begin(), event.end(), ignoreUnknown);
+            std::size_t last = first;
+            for (; last < order.size() && events[order[last]] == event; ++last) results[order[last]] = result;
+            first = last;
+        }
+        return results;
+    }
+
+    std::vector<QueryResult> probabilitiesOf(const std::vector<std::set<T>>& events) const {
+        return probabilitiesOf(events, ignoreUnknown);
+    }
+
+    /**
+     * @brief Calculate P(A|B) for many events A under one shared condition B.
+     *
+     * B is validated and summed once for the whole batch, after which each A
+     * costs a single walk.
+     *
+     * @param eventsA The events A to evaluate.
+     * @param eventB The condition shared by all queries.
+     * @param ignoreUnknown Whether outcomes not in the sample space are skipped for this batch.
+     * @return One result per event A, in the same order as the events.
+     */
+    std::vector<QueryResult> conditionalProbabilitiesOf(const std::vector<std::set<T>>& eventsA,
+                                                        const std::set<T>& eventB, bool ignoreUnknown) const {
+        std::vector<QueryResult> results(eventsA.size());
+        ScratchScope scratch;
+        ConditionScratch condition = conditionOf(eventB, ignoreUnknown, scratch.resource());
+        for (std::size_t i = 0; i < eventsA.size(); ++i) {
+            results[i] = conditionedQuery(eventsA[i], condition, ignoreUnknown);
+        }
+        return results;
+    }
+
+    std::vector<QueryResult> conditionalProbabilitiesOf(const std::vector<std::set<T>>& eventsA,
+                                                        const std::set<T>& eventB) const {
+        return conditionalProbabilitiesOf(eventsA, eventB, ignoreUnknown);
+    }
+
+    /**
+     * @brief Calculate P(A_i|B_i) for many pairs of events.
+     *
+     * Queries are grouped by their condition, so each distinct B is validated and
+     * summed once no matter how many queries share it.
+     *
+     * @param eventsA The events A_i.
+     * @param eventsB The conditions B_i, one per event A_i.
+     * @param ignoreUnknown Whether outcomes not in the sample space are skipped for this batch.
+     * @return One result per pair, in the same order as the pairs.
+     * @throws std::invalid_argument if the number of events and conditions differ.
+     */
+    std::vector<QueryResult> conditionalProbabilitiesOf(const std::vector<std::set<T>>& eventsA,
+                                                        const std::vector<std::set<T>>& eventsB,
+                                                        bool ignoreUnknown) const {
+        if (eventsA.size() != eventsB.size())
+            throw std::invalid_argument("Batch needs one condition per event");
+
+        ScratchScope scratch;
+        std::pmr::vector<std::size_t> order(eventsA.size(), scratch.resource());
+        for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(),
+                         [&](std::size_t a, std::size_t b){ return eventsB[a] < eventsB[b]; });
+
+        std::vector<QueryResult> results(eventsA.size());
+        ConditionScratch condition(scratch.resource());
+        for (std::size_t first = 0; first < order.size();) {
+            const std::set<T>& eventB = eventsB[order[first]];
+            conditionOf(eventB, ignoreUnknown, condition);
+            std::size_t last = first;
+            for (; last < order.size() && eventsB[order[last]] == eventB; ++last) {
+                results[order[last]] = conditionedQuery(eventsA[order[last]], condition, ignoreUnknown);
+            }
+            first = last;
+        }
+        return results;
+    }
+
+    std::vector<QueryResult> conditionalProbabilitiesOf(const std::vector<std::set<T>>& eventsA,
+                                                        const std::vector<std::set<T>>& eventsB) const {
+        return conditionalProbabilitiesOf(eventsA, eventsB, ignoreUnknown);
+    }
+
+    /**
+     * @brief Calculate the probabilities of many events across the threads of an executor.
+     *
+     * Queries only read the space, so any number of batches can run at the same time
+     * as long as the mode is passed explicitly and setIgnoreUnknown() is not called
+     * concurrently. Each result is written straight into its slot of the output.
+     *
+     * @param events The events to evaluate.
+     * @param results Receives one result per event. Its storage is reused if it is
+     * already large enough.
+     * @param ignoreUnknown Whether outcomes not in the sample space are skipped for this batch.
+     * @param executor The thread pool to run the batch on.
+     */
+    void evaluateParallel(const std::vector<std::set<T>>& events, std::vector<QueryResult>& results,
+                          bool ignoreUnknown, WorkStealingExecutor& executor) const {
+        results.resize(events.size());
+        QueryResult* out = results.data();
+        executor.forEachChunk(events.size(), 0, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                out[i] = probabilityCalculator(events[i].begin(), events[i].end(), ignoreUnknown);
+            }
+        });
+    }
+
+    /**
+     * @brief Calculate P(A|B) for many events A under one condition B across the threads of an executor.
+     *
+     * B is validated once on the calling thread and then shared read-only by all threads.
+     */
+    void evaluateParallel(const std::vector<std::set<T>>& eventsA, const std::set<T>& eventB,
+                          std::vector<QueryResult>& results, bool ignoreUnknown,
+                          WorkStealingExecutor& executor) const {
+        results.resize(eventsA.size());
+        QueryResult* out = results.data();
+        ScratchScope scratch;
+        const ConditionScratch condition = conditionOf(eventB, ignoreUnknown, scratch.resource());
+        executor.forEachChunk(eventsA.size(), 0, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                out[i] = conditionedQuery(eventsA[i], condition, ignoreUnknown);
+            }
+        });
+    }
+
+    // Number of outcomes in the sample space
+    std::size_t size() const {
+        return outcomes.size();
+    }
+
+    // Outcomes in ascending order and their probabilities, index by index
+    const T& outcomeAt(std::size_t index) const {
+        return outcomes[index];
+    }
+
+    double probabilityAt(std::size_t index) const {
+        return probabilities[index];
+    }
+
+    const double* probabilityData() const {
+        return probabilities.data();
+    }
+
+    // Spaces derived from one another, e.g. by bayesUpdate(), share their outcomes
+    const T* outcomeData() const {
+        return outcomes.data();
+    }
+
+    // Whether outcomes are found by direct indexing rather than a binary search
+    bool isDirectlyIndexed() const {
+        return keyIndex != KeyIndex::Search;
+    }
+
+    bool getCurrentMode() const {
+        return ignoreUnknown;
+    }
+
+    void setIgnoreUnknown(bool mode) {
+        ignoreUnknown = mode;
+    }
+
+};
+
+/**
+ * @brief The view P(.|B) of a probability space conditioned on an event B.
+ *
+ * Created by ProbabilitySpace::conditionOn(). The view shares the storage of the
+ * space and holds the sorted positions of the outcomes of B together with 1/P(B),
+ * so a query P(A|B) is a single walk over A and B that sums the probabilities of
+ * the common outcomes, without computing P(B) again and without allocating.
+ * Conditioning a view on C gives the view of B n C. Whether unknown outcomes are
+ * skipped follows the mode the space had when the view was created.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T, typename Sum>
+class ConditionedSpace {
+private:
+    friend class ProbabilitySpace<T, Sum>;
+
+    ProbabilitySpace<T, Sum> space;
+    std::vector<std::size_t> indices;
+    double probability;
+    double normalizer;
+
+    ConditionedSpace(const ProbabilitySpace<T, Sum>& space, std::vector<std::size_t> indices)
+        : space(space), indices(std::move(indices)) {
+        probability = this->space.indexCalculator(this->indices);
+        if (probability == 0) ProbabilitySpace<T, Sum>::valueOf({0.0, QueryError::ZeroProbabilityCondition});
+        normalizer = 1.0 / probability;
+    }
+
+    double scaled(const QueryResult& result) const {
+        return ProbabilitySpace<T, Sum>::valueOf(result) * normalizer;
+    }
+
+public:
+    // Number of outcomes left in the condition
+    std::size_t size() const {
+        return indices.size();
+    }
+
+    // P(B) of the condition in the parent space
+    double conditionProbability() const {
+        return probability;
+    }
+
+    /**
+     * @brief Calculate P(A|B).
+     *
+     * @throws std::invalid_argument if A contains an outcome not in the sample space,
+     * unless unknown outcomes are ignored.
+     */
+    double probabilityOfSet(const std::set<T>& eventA) const {
+        return scaled(space.conditionedWalk(eventA.begin(), eventA.end(), indices, space.ignoreUnknown));
+    }
+
+    // P(A|B) for a sorted range of outcomes
+    template <typename It, typename = std::enable_if_t<
+        std::is_convertible_v<typename std::iterator_traits<It>::value_type, T>>>
+    double probabilityOfSet(It first, It last) const {
+        ProbabilitySpace<T, Sum>::isSortedEvent(first, last);
+        return scaled(space.conditionedWalk(first, last, indices, space.ignoreUnknown));
+    }
+
+    double probabilityOfSet(const ValidatedEvent<T>& eventA) const {
+        space.isSameSpace(eventA);
+        return space.indexIntersection(eventA.outcomeIndices(), indices) * normalizer;
+    }
+
+    double probabilityOfMask(const EventMask& maskA) const {
+        space.isSameSpace(maskA);
+        BlockedSum<Sum> total;
+        for (auto i : indices) {
+            if (maskA.test(i)) total.add(space.probabilities[i]);
+        }
+        return total.result() * normalizer;
+    }
+
+    // P(A^c|B), the probability of the outcomes of B that are not in A
+    double complementOfEvent(const std::set<T>& eventA) const {
+        return 1.0 - probabilityOfSet(eventA);
+    }
+
+    /**
+     * @brief Condition the view further on an event C.
+     *
+     * @return The view of the space conditioned on B n C.
+     * @throws std::invalid_argument if C contains an outcome not in the sample space,
+     * unless unknown outcomes are ignored, or P(B n C)=0.
+     */
+    ConditionedSpace conditionOn(const std::set<T>& eventC) const {
+        std::vector<std::size_t> common;
+        std::size_t pos = 0;
+        std::size_t j = 0;
+        for (const auto& outcome : eventC) {
+            if (space.locate(outcome, pos)) {
+                while (j < indices.size() && indices[j] < pos) ++j;
+                if (j < indices.size() && indices[j] == pos) common.push_back(pos);
+            }
+            else if (!space.ignoreUnknown) {
+                ProbabilitySpace<T, Sum>::valueOf({0.0, QueryError::UnknownOutcome});
+            }
+        }
+        return ConditionedSpace(space, std::move(common));
+    }
+
+    ConditionedSpace conditionOn(const ValidatedEvent<T>& eventC) const {
+        space.isSameSpace(eventC);
+        std::vector<std::size_t> common;
+        std::set_intersection(indices.begin(), indices.end(), eventC.outcomeIndices().begin(), eventC.outcomeIndices().end(),
+                              std::back_inserter(common));
+        return ConditionedSpace(space, std::move(common));
+    }
 };
 
+#endif
@@ -0,0 +1,350 @@
+#ifndef PROBABILITY_SPACE_BUILDER_H
+#define PROBABILITY_SPACE_BUILDER_H
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "probability_space.h"
+#include "executor.h"
+
+
+/**
+ * @brief How outcomes are written to and read back from the spill files of a builder.
+ *
+ * Trivially copyable outcomes are stored as their bytes, strings with a length prefix.
+ * Other outcome types can be streamed by specializing this template.
+ */
+template <typename T, typename = void>
+struct SpillCodec {
+    static_assert(sizeof(T) == 0, "Specialize SpillCodec to stream outcomes of this type");
+};
+
+template <typename T>
+struct SpillCodec<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+    // Bytes of memory held by an outcome in the buffer of a builder
+    static std::size_t footprint(const T&) { return sizeof(T); }
+
+    static bool write(std::FILE* file, const T& outcome) {
+        return std::fwrite(&outcome, sizeof(T), 1, file) == 1;
+    }
+
+    static bool read(std::FILE* file, T& outcome) {
+        return std::fread(&outcome, sizeof(T), 1, file) == 1;
+    }
+};
+
+template <>
+struct SpillCodec<std::string> {
+    static std::size_t footprint(const std::string& outcome) { return sizeof(std::string) + outcome.capacity(); }
+
+    static bool write(std::FILE* file, const std::string& outcome) {
+        std::uint64_t length = outcome.size();
+        return std::fwrite(&length, sizeof(length), 1, file) == 1 &&
+               std::fwrite(outcome.data(), 1, outcome.size(), file) == outcome.size();
+    }
+
+    static bool read(std::FILE* file, std::string& outcome) {
+        std::uint64_t length = 0;
+        if (std::fread(&length, sizeof(length), 1, file) != 1) return false;
+        outcome.resize(static_cast<std::size_t>(length));
+        return std::fread(&outcome[0], 1, outcome.size(), file) == outcome.size();
+    }
+};
+
+/**
+ * @brief Parse the outcome field of a line of text.
+ *
+ * Integers and floating point numbers are parsed with std::from_chars, strings are
+ * taken as they are.
+ *
+ * @throws std::invalid_argument if the text is not a valid outcome.
+ */
+template <typename T>
+T parseOutcome(std::string_view text) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        return std::string(text);
+    }
+    else {
+        static_assert(std::is_arithmetic_v<T>, "Pass a parser for outcomes of this type");
+        T value{};
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc() || end != text.data() + text.size())
+            throw std::invalid_argument("Malformed outcome: " + std::string(text));
+        return value;
+    }
+}
+
+/**
+ * @brief Builds a ProbabilitySpace from a stream of outcomes and probabilities in bounded memory.
+ *
+ * Outcomes arrive in any order and may repeat; the probabilities of a repeated outcome
+ * are added up. Entries collect in a buffer until it reaches the memory budget. The
+ * buffer is then sorted, its duplicates are merged and it is spilled to a temporary
+ * file as a sorted run. build() merges all runs into the dense arrays of the space in
+ * one pass, so apart from the final arrays memory stays within the budget plus one
+ * entry per run.
+ *
+ * The total is accumulated with Neumaier compensation as the entries arrive, so an
+ * input that doesn't sum to one is rejected before the final merge.
+ *
+ * @tparam T The type of outcomes. It must be supported by SpillCodec.
+ */
+template <typename T>
+class ProbabilitySpaceBuilder {
+private:
+    // Size of the blocks of input read at once by addCsv()
+    static constexpr std::size_t CSV_CHUNK = std::size_t{1} << 22;
+
+    using Entry = std::pair<T, double>;
+    using File = std::unique_ptr<std::FILE, int (*)(std::FILE*)>;
+
+    std::size_t budget;
+    std::vector<Entry> buffer;
+    std::size_t bufferBytes = 0;
+    std::vector<File> runs;
+    std::size_t entryCount = 0;
+    double sum = 0.0;
+    double compensation = 0.0;
+
+    void addToTotal(double probability) {
+        double t = sum + probability;
+        compensation += std::abs(sum) >= std::abs(probability) ? (sum - t) + probability : (probability - t) + sum;
+        sum = t;
+    }
+
+    // Sort the buffer and merge the entries of repeated outcomes.
+    void collapse() {
+        std::sort(buffer.begin(), buffer.end(), [](const Entry& a, const Entry& b){ return a.first < b.first; });
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < buffer.size(); ++i) {
+            if (kept > 0 && !(buffer[kept - 1].first < buffer[i].first)) buffer[kept - 1].second += buffer[i].second;
+            else if (kept++ != i) buffer[kept - 1] = std::move(buffer[i]);
+        }
+        buffer.erase(buffer.begin() + static_cast<std::ptrdiff_t>(kept), buffer.end());
+    }
+
+    void spill() {
+        collapse();
+        File file(std::tmpfile(), &std::fclose);
+        if (!file) throw std::runtime_error("Could not create spill file");
+        for (const auto& [outcome, probability] : buffer) {
+            if (!SpillCodec<T>::write(file.get(), outcome) ||
+                std::fwrite(&probability, sizeof(probability), 1, file.get()) != 1)
+                throw std::runtime_error("Could not write spill file");
+        }
+        if (std::fflush(file.get()) != 0) throw std::runtime_error("Could not write spill file");
+        std::rewind(file.get());
+        runs.push_back(std::move(file));
+        buffer.clear();
+        bufferBytes = 0;
+    }
+
+    // Cursor over one sorted run, either spilled or the buffer itself.
+    struct Run {
+        std::FILE* file = nullptr;
+        Entry* next = nullptr;
+        Entry* end = nullptr;
+        Entry head;
+
+        bool advance() {
+            if (!file) {
+                if (next == end) return false;
+                head = std::move(*next++);
+                return true;
+            }
+            if (!SpillCodec<T>::read(file, head.first)) return false;
+            if (std::fread(&head.second, sizeof(head.second), 1, file) != 1)
+                throw std::runtime_error("Could not read spill file");
+            return true;
+        }
+    };
+
+    // Split one line into its outcome and probability. The probability follows
+    // the last comma, so string outcomes may contain commas themselves.
+    template <typename Parse>
+    static void parseLine(std::string_view line, Parse& parse, std::vector<Entry>& out) {
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        auto trim = [](std::string_view text) {
+            while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+            while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+            return text;
+        };
+        if (trim(line).empty()) return;
+        std::size_t comma = line.rfind(',');
+        if (comma == std::string_view::npos)
+            throw std::invalid_argument("Malformed outcome,probability line: " + std::string(line));
+        std::string_view field = trim(line.substr(comma + 1));
+        double probability = 0.0;
+        auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), probability);
+        if (error != std::errc() || end != field.data() + field.size())
+            throw std::invalid_argument("Malformed outcome,probability line: " + std::string(line));
+        out.emplace_back(parse(trim(line.substr(0, comma))), probability);
+    }
+
+public:
+    /**
+     * @brief Start an empty builder.
+     *
+     * @param memoryBudget Bytes the buffered entries may take before they are spilled.
+     */
+    explicit ProbabilitySpaceBuilder(std::size_t memoryBudget = std::size_t{64} << 20) : budget(memoryBudget) {}
+
+    /**
+     * @brief Add the probability of an outcome, to be added to earlier entries of the same outcome.
+     *
+     * @throws std::invalid_argument if the probability is negative.
+     */
+    void add(T outcome, double probability) {
+        if (!(probability >= 0.0)) throw std::invalid_argument("Probabilities must be nonnegative");
+        addToTotal(probability);
+        ++entryCount;
+        bufferBytes += sizeof(Entry) - sizeof(T) + SpillCodec<T>::footprint(outcome);
+        buffer.emplace_back(std::move(outcome), probability);
+        if (bufferBytes >= budget) spill();
+    }
+
+    /**
+     * @brief Add every "outcome,probability" line of a text stream, parsing across the threads of an executor.
+     *
+     * The input is read in blocks of a few megabytes that are split at line breaks and
+     * parsed in parallel. Entries are added in input order, so the result doesn't depend
+     * on the number of threads. Empty lines are skipped. parse is called from several
+     * threads at once.
+     *
+     * @param input The text to read until its end.
+     * @param executor The thread pool to parse on.
+     * @param parse Callable turning the outcome field, a std::string_view, into a T.
+     * @throws std::invalid_argument if a line is malformed or a probability is negative.
+     */
+    template <typename Parse>
+    void addCsv(std::istream& input, WorkStealingExecutor& executor, Parse parse) {
+        std::string block;
+        std::vector<std::vector<Entry>> parsed(executor.threadCount() * 4);
+        std::vector<std::size_t> cuts(parsed.size() + 1);
+        std::size_t carried = 0;
+        while (input) {
+            block.resize(carried + CSV_CHUNK);
+            input.read(&block[carried], static_cast<std::streamsize>(CSV_CHUNK));
+            std::size_t filled = carried + static_cast<std::size_t>(input.gcount());
+            // Parse up to the last complete line and carry the rest into the next
+            // block. At the end of the input the rest is the last line.
+            std::size_t usable = filled;
+            if (input) {
+                std::size_t lastBreak = block.rfind('\n', filled == 0 ? 0 : filled - 1);
+                usable = lastBreak == std::string::npos ? 0 : lastBreak + 1;
+            }
+
+            std::string_view text(block.data(), usable);
+            cuts[0] = 0;
+            for (std::size_t s = 1; s < parsed.size(); ++s) {
+                std::size_t cut = std::max(cuts[s - 1], s * usable / parsed.size());
+                if (cut > 0 && cut < usable) {
+                    std::size_t lineBreak = text.find('\n', cut - 1);
+                    cut = lineBreak == std::string_view::npos ? usable : lineBreak + 1;
+                }
+                cuts[s] = cut;
+            }
+            cuts[parsed.size()] = usable;
+            executor.forEachChunk(parsed.size(), 1, [&](std::size_t s, std::size_t) {
+                parsed[s].clear();
+                std::string_view slice = text.substr(cuts[s], cuts[s + 1] - cuts[s]);
+                while (!slice.empty()) {
+                    std::size_t lineBreak = slice.find('\n');
+                    parseLine(slice.substr(0, lineBreak), parse, parsed[s]);
+                    slice.remove_prefix(lineBreak == std::string_view::npos ? slice.size() : lineBreak + 1);
+                }
+            });
+            for (auto& entries : parsed) {
+                for (auto& [outcome, probability] : entries) add(std::move(outcome), probability);
+            }
+
+            carried = filled - usable;
+            block.erase(0, usable);
+        }
+    }
+
+    // Parse outcomes with parseOutcome<T>().
+    void addCsv(std::istream& input, WorkStealingExecutor& executor) {
+        addCsv(input, executor, [](std::string_view text){ return parseOutcome<T>(text); });
+    }
+
+    // Number of entries added so far, counting repeated outcomes every time
+    std::size_t entries() const {
+        return entryCount;
+    }
+
+    // Compensated sum of all probabilities added so far
+    double total() const {
+        return sum + compensation;
+    }
+
+    // Number of sorted runs spilled to temporary files so far
+    std::size_t spilledRuns() const {
+        return runs.size();
+    }
+
+    /**
+     * @brief Merge everything added into a probability space and reset the builder.
+     *
+     * @throws std::invalid_argument if the probabilities don't sum up to one.
+     * @throws std::runtime_error if a spill file cannot be read.
+     */
+    ProbabilitySpace<T> build() {
+        if (std::abs(total() - 1.0) > sumTolerance(entries())) throw std::invalid_argument("Probabilities must sum to 1");
+        collapse();
+        std::vector<T> keys;
+        std::vector<double> probs;
+
+        if (runs.empty()) {
+            keys.reserve(buffer.size());
+            probs.reserve(buffer.size());
+            for (auto& [outcome, probability] : buffer) {
+                keys.push_back(std::move(outcome));
+                probs.push_back(probability);
+            }
+        }
+        else {
+            std::vector<Run> cursors(runs.size() + 1);
+            for (std::size_t r = 0; r < runs.size(); ++r) cursors[r].file = runs[r].get();
+            cursors.back().next = buffer.data();
+            cursors.back().end = buffer.data() + buffer.size();
+
+            auto later = [&](std::size_t a, std::size_t b){ return cursors[b].head.first < cursors[a].head.first; };
+            std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> heads(later);
+            for (std::size_t r = 0; r < cursors.size(); ++r) {
+                if (cursors[r].advance()) heads.push(r);
+            }
+            while (!heads.empty()) {
+                std::size_t r = heads.top();
+                heads.pop();
+                if (!keys.empty() && !(keys.back() < cursors[r].head.first)) {
+                    probs.back() += cursors[r].head.second;
+                }
+                else {
+                    keys.push_back(std::move(cursors[r].head.first));
+                    probs.push_back(cursors[r].head.second);
+                }
+                if (cursors[r].advance()) heads.push(r);
+            }
+        }
+
+        *this = ProbabilitySpaceBuilder(budget);
+        return ProbabilitySpace<T>(SORTED_UNIQUE, std::move(keys), std::move(probs));
+    }
+};
+
+#endif
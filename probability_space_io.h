@@ -0,0 +1,249 @@
+#ifndef PROBABILITY_SPACE_IO_H
+#define PROBABILITY_SPACE_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "probability_space.h"
+
+
+/**
+ * @brief Binary on-disk format of probability spaces, loaded by mapping the file into memory.
+ *
+ * A file starts with a fixed header followed by three arrays, each starting at a
+ * multiple of ALIGNMENT: the raw outcomes, their probabilities and the prefix sums
+ * of the probabilities (one entry more than the outcomes). A loaded space queries
+ * the mapped pages in place, so loading does no parsing, no summation and no
+ * per-outcome allocation, and processes mapping the same file share its pages
+ * through the page cache.
+ *
+ * The header records that the arrays passed the validation of the constructors,
+ * which every space written by save() has. Only files without that flag are
+ * validated again on load. The checksum covers the three arrays and is only
+ * verified on request, since it costs a pass over the whole file.
+ *
+ * Outcomes are stored as their object representation, so the format is limited to
+ * trivially copyable outcome types and files are only portable between machines
+ * with the same byte order and type layout. Both are checked on load.
+ */
+class ProbabilitySpaceFile {
+public:
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr std::size_t ALIGNMENT = 64;
+
+private:
+    static constexpr char MAGIC[8] = {'P', 'R', 'O', 'B', 'S', 'P', 'C', '\0'};
+    static constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static constexpr std::uint32_t VALIDATED = 1;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint32_t flags;
+        std::uint32_t outcomeSize;
+        std::uint64_t outcomeAlignment;
+        std::uint64_t count;
+        std::uint64_t outcomesOffset;
+        std::uint64_t probabilitiesOffset;
+        std::uint64_t cumulativeOffset;
+        std::uint64_t fileSize;
+        std::uint64_t checksum;
+    };
+
+    // Running 64-bit checksum over whole words, with a final mix so that
+    // every input bit affects every output bit.
+    class Checksum {
+    private:
+        std::uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    public:
+        void add(const void* data, std::size_t bytes) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            for (; bytes >= 8; p += 8, bytes -= 8) {
+                std::uint64_t word;
+                std::memcpy(&word, p, 8);
+                state = (state ^ word) * 0x100000001b3ull;
+                state ^= state >> 29;
+            }
+            if (bytes > 0) {
+                std::uint64_t word = 0;
+                std::memcpy(&word, p, bytes);
+                state = (state ^ word ^ (std::uint64_t{bytes} << 56)) * 0x100000001b3ull;
+                state ^= state >> 29;
+            }
+        }
+
+        std::uint64_t value() const {
+            std::uint64_t h = state;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 33;
+            return h;
+        }
+    };
+
+    static std::uint64_t alignUp(std::uint64_t offset) {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    // Offsets of the arrays of a file with count outcomes of the given size.
+    static void layout(Header& header, std::uint64_t count, std::uint64_t outcomeSize) {
+        header.count = count;
+        header.outcomesOffset = alignUp(sizeof(Header));
+        header.probabilitiesOffset = alignUp(header.outcomesOffset + count * outcomeSize);
+        header.cumulativeOffset = alignUp(header.probabilitiesOffset + count * sizeof(double));
+        header.fileSize = header.cumulativeOffset + (count + 1) * sizeof(double);
+    }
+
+    static std::uint64_t checksumOf(const unsigned char* base, const Header& header) {
+        Checksum checksum;
+        checksum.add(base + header.outcomesOffset, header.count * header.outcomeSize);
+        checksum.add(base + header.probabilitiesOffset, header.count * sizeof(double));
+        checksum.add(base + header.cumulativeOffset, (header.count + 1) * sizeof(double));
+        return checksum.value();
+    }
+
+    // Write padding up to the given offset followed by an array.
+    static void writeAt(std::FILE* file, std::uint64_t& position, std::uint64_t offset,
+                        const void* data, std::size_t bytes) {
+        static const char zeros[ALIGNMENT] = {};
+        if (std::fwrite(zeros, 1, offset - position, file) != offset - position ||
+            std::fwrite(data, 1, bytes, file) != bytes)
+            throw std::runtime_error("Could not write probability space file");
+        position = offset + bytes;
+    }
+
+    // Owner of a read-only mapping, unmapped when the last space using it goes away.
+    struct Mapping {
+        void* address = MAP_FAILED;
+        std::size_t length = 0;
+
+        ~Mapping() {
+            if (address != MAP_FAILED) munmap(address, length);
+        }
+    };
+
+    template <typename T>
+    static void checkOutcomeType() {
+        static_assert(std::is_trivially_copyable_v<T>,
+                      "Only spaces of trivially copyable outcomes can be stored in the binary format");
+    }
+
+public:
+    /**
+     * @brief Write a probability space to a file in the binary format.
+     *
+     * @param space The space to write.
+     * @param path Path of the file, replaced if it exists.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    template <typename T>
+    static void save(const ProbabilitySpace<T>& space, const std::string& path) {
+        checkOutcomeType<T>();
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.flags = VALIDATED;
+        header.outcomeSize = sizeof(T);
+        header.outcomeAlignment = alignof(T);
+        layout(header, space.size(), sizeof(T));
+
+        Checksum checksum;
+        checksum.add(space.outcomes.data(), space.outcomes.size() * sizeof(T));
+        checksum.add(space.probabilities.data(), space.probabilities.size() * sizeof(double));
+        checksum.add(space.cumulative.data(), space.cumulative.size() * sizeof(double));
+        header.checksum = checksum.value();
+
+        std::unique_ptr<std::FILE, int (*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), &std::fclose);
+        if (!file) throw std::runtime_error("Could not open probability space file " + path);
+        std::uint64_t position = 0;
+        writeAt(file.get(), position, 0, &header, sizeof(header));
+        writeAt(file.get(), position, header.outcomesOffset, space.outcomes.data(), space.size() * sizeof(T));
+        writeAt(file.get(), position, header.probabilitiesOffset, space.probabilities.data(),
+                space.size() * sizeof(double));
+        writeAt(file.get(), position, header.cumulativeOffset, space.cumulative.data(),
+                space.cumulative.size() * sizeof(double));
+        if (std::fclose(file.release()) != 0)
+            throw std::runtime_error("Could not write probability space file " + path);
+    }
+
+    /**
+     * @brief Map a file written by save() and query it in place.
+     *
+     * Loading only checks the header against the file, in O(1) for files marked as
+     * validated. The mapping stays alive as long as the returned space or any of its
+     * copies exist.
+     *
+     * @param path Path of the file.
+     * @param verifyChecksum Whether to verify the checksum of the arrays, in O(n).
+     * @throws std::runtime_error if the file cannot be opened or mapped.
+     * @throws std::invalid_argument if the file is not a probability space of T in this
+     * format, fails its checksum, or is not validated and holds an invalid distribution.
+     */
+    template <typename T>
+    static ProbabilitySpace<T> load(const std::string& path, bool verifyChecksum = false) {
+        checkOutcomeType<T>();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open probability space file " + path);
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            close(fd);
+            throw std::runtime_error("Could not open probability space file " + path);
+        }
+        auto mapping = std::make_shared<Mapping>();
+        mapping->length = static_cast<std::size_t>(status.st_size);
+        if (mapping->length >= sizeof(Header))
+            mapping->address = mmap(nullptr, mapping->length, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping->length < sizeof(Header)) throw std::invalid_argument("Not a probability space file");
+        if (mapping->address == MAP_FAILED) throw std::runtime_error("Could not map probability space file " + path);
+
+        const unsigned char* base = static_cast<const unsigned char*>(mapping->address);
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::invalid_argument("Not a probability space file");
+        if (header.version != VERSION)
+            throw std::invalid_argument("Unsupported probability space file version");
+        if (header.byteOrder != BYTE_ORDER_MARK || header.outcomeSize != sizeof(T) ||
+            header.outcomeAlignment != alignof(T))
+            throw std::invalid_argument("Probability space file was written for a different outcome type");
+
+        // The layout is fully determined by the count, so a header whose offsets
+        // don't match it or the size of the file is corrupt.
+        Header expected = header;
+        if (header.count > mapping->length / (sizeof(T) + 2 * sizeof(double)))
+            throw std::invalid_argument("Probability space file is truncated or corrupt");
+        layout(expected, header.count, sizeof(T));
+        if (std::memcmp(&expected, &header, sizeof(header)) != 0 || header.fileSize != mapping->length)
+            throw std::invalid_argument("Probability space file is truncated or corrupt");
+        if (verifyChecksum && checksumOf(base, header) != header.checksum)
+            throw std::invalid_argument("Probability space file fails its checksum");
+
+        std::size_t count = static_cast<std::size_t>(header.count);
+        const T* keys = reinterpret_cast<const T*>(base + header.outcomesOffset);
+        const double* probs = reinterpret_cast<const double*>(base + header.probabilitiesOffset);
+        const double* sums = reinterpret_cast<const double*>(base + header.cumulativeOffset);
+        // Files from other writers get the full validation and fresh prefix sums
+        if (!(header.flags & VALIDATED))
+            return ProbabilitySpace<T>(SORTED_UNIQUE, keys, probs, count, std::move(mapping));
+        return ProbabilitySpace<T>(keys, probs, sums, count, std::move(mapping));
+    }
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef PRODUCT_SPACE_H
+#define PRODUCT_SPACE_H
+
+#include <array>
+#include <cstddef>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "probability_space.h"
+
+
+/**
+ * @brief The joint space of several independent probability spaces.
+ *
+ * Outcomes are tuples with one outcome of every factor, and the probability of a
+ * tuple is the product of the probabilities of its components. The joint table is
+ * never stored: rectangular events, products of one event per factor, are answered
+ * from the marginals in O(sum of the event sizes), and joint outcomes are enumerated
+ * on demand. Only materialize() builds the table with all prod n_i outcomes.
+ *
+ * Whether unknown outcomes are skipped follows the mode of each factor.
+ *
+ * @tparam Ts The outcome types of the factors.
+ */
+template <typename... Ts>
+class ProductSpace {
+    static_assert(sizeof...(Ts) > 0, "A product space needs at least one factor");
+
+private:
+    static constexpr std::size_t N = sizeof...(Ts);
+    using Indices = std::index_sequence_for<Ts...>;
+
+    std::tuple<ProbabilitySpace<Ts>...> factors;
+
+    template <std::size_t... I>
+    std::array<std::size_t, N> sizes(std::index_sequence<I...>) const {
+        return {std::get<I>(factors).size()...};
+    }
+
+    template <std::size_t... I>
+    std::tuple<Ts...> outcomeAt(const std::array<std::size_t, N>& digits, std::index_sequence<I...>) const {
+        return std::tuple<Ts...>(std::get<I>(factors).outcomeAt(digits[I])...);
+    }
+
+    template <std::size_t... I>
+    double probabilityAt(const std::array<std::size_t, N>& digits, std::index_sequence<I...>) const {
+        return (1.0 * ... * std::get<I>(factors).probabilityAt(digits[I]));
+    }
+
+    // Digits of a joint index, the last factor varying fastest
+    std::array<std::size_t, N> digitsOf(std::size_t index) const {
+        std::array<std::size_t, N> radix = sizes(Indices{});
+        std::array<std::size_t, N> digits{};
+        for (std::size_t k = N; k-- > 0;) {
+            digits[k] = index % radix[k];
+            index /= radix[k];
+        }
+        return digits;
+    }
+
+    template <std::size_t... I>
+    double pointProbability(const std::tuple<Ts...>& outcome, std::index_sequence<I...>) const {
+        return (1.0 * ... * std::get<I>(factors).probabilityOfSet(&std::get<I>(outcome), &std::get<I>(outcome) + 1));
+    }
+
+    template <std::size_t... I, typename... Events>
+    double rectangle(std::index_sequence<I...>, const Events&... events) const {
+        return (1.0 * ... * std::get<I>(factors).probabilityOfSet(events));
+    }
+
+    template <std::size_t... I, typename... Events>
+    double rectangleIntersection(std::index_sequence<I...>, const std::tuple<const Events&...>& eventsA,
+                                 const std::tuple<const Events&...>& eventsB) const {
+        return (1.0 * ... * std::get<I>(factors).intersectionOfEvents(std::get<I>(eventsA), std::get<I>(eventsB)));
+    }
+
+public:
+    using Outcome = std::tuple<Ts...>;
+
+    /**
+     * @brief Combine independent spaces into their product.
+     *
+     * The factors share their storage with the spaces passed in, so this is O(1).
+     */
+    explicit ProductSpace(ProbabilitySpace<Ts>... spaces) : factors(std::move(spaces)...) {}
+
+    // The I-th marginal distribution
+    template <std::size_t I>
+    const ProbabilitySpace<std::tuple_element_t<I, Outcome>>& marginal() const {
+        return std::get<I>(factors);
+    }
+
+    // Number of joint outcomes, the product of the sizes of the factors
+    std::size_t size() const {
+        std::size_t total = 1;
+        for (std::size_t n : sizes(Indices{})) total *= n;
+        return total;
+    }
+
+    /**
+     * @brief Calculate the probability of a single joint outcome in O(sum log n_i).
+     *
+     * @throws std::invalid_argument if a component is not in its factor, unless that
+     * factor ignores unknown outcomes.
+     */
+    double probabilityOf(const Outcome& outcome) const {
+        return pointProbability(outcome, Indices{});
+    }
+
+    /**
+     * @brief Calculate the probability of the rectangle E_1 x ... x E_k from the marginals.
+     *
+     * @param events One event of every factor.
+     * @throws std::invalid_argument if an event contains an outcome not in its factor,
+     * unless that factor ignores unknown outcomes.
+     */
+    double probabilityOfRectangle(const std::set<Ts>&... events) const {
+        return rectangle(Indices{}, events...);
+    }
+
+    // Rectangles of validated events skip all membership checks.
+    double probabilityOfRectangle(const ValidatedEvent<Ts>&... events) const {
+        return rectangle(Indices{}, events...);
+    }
+
+    double complementOfRectangle(const std::set<Ts>&... events) const {
+        return 1.0 - rectangle(Indices{}, events...);
+    }
+
+    /**
+     * @brief Calculate P(A|B) for two rectangles, given as tuples of one event per factor.
+     *
+     * The intersection of two rectangles is the rectangle of the intersections, so
+     * this stays within the marginals too.
+     *
+     * @throws std::invalid_argument if P(B)=0 or an event contains an outcome not in its factor.
+     */
+    double conditionalProbability(const std::tuple<const std::set<Ts>&...>& eventsA,
+                                  const std::tuple<const std::set<Ts>&...>& eventsB) const {
+        double probB = std::apply([&](const auto&... events){ return rectangle(Indices{}, events...); }, eventsB);
+        if (probB == 0)
+            throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
+        return rectangleIntersection(Indices{}, eventsA, eventsB) / probB;
+    }
+
+    // Joint outcome by index, in ascending order of the tuples
+    Outcome outcomeAt(std::size_t index) const {
+        return outcomeAt(digitsOf(index), Indices{});
+    }
+
+    double probabilityAt(std::size_t index) const {
+        return probabilityAt(digitsOf(index), Indices{});
+    }
+
+    /**
+     * @brief Call f(outcome, probability) for every joint outcome in ascending order.
+     *
+     * Outcomes are generated one at a time, so enumeration needs no memory beyond
+     * the current tuple.
+     */
+    template <typename F>
+    void forEachOutcome(F f) const {
+        std::array<std::size_t, N> radix = sizes(Indices{});
+        for (std::size_t n : radix) {
+            if (n == 0) return;
+        }
+        std::array<std::size_t, N> digits{};
+        for (;;) {
+            f(outcomeAt(digits, Indices{}), probabilityAt(digits, Indices{}));
+            std::size_t k = N;
+            while (k > 0 && ++digits[k - 1] == radix[k - 1]) digits[--k] = 0;
+            if (k == 0) return;
+        }
+    }
+
+    /**
+     * @brief Build the joint table as an ordinary probability space of tuples.
+     *
+     * This costs O(prod n_i) time and memory and is only needed for queries on
+     * events that are not rectangles.
+     */
+    ProbabilitySpace<Outcome> materialize() const {
+        std::vector<Outcome> keys;
+        std::vector<double> probs;
+        keys.reserve(size());
+        probs.reserve(size());
+        forEachOutcome([&](const Outcome& outcome, double probability) {
+            keys.push_back(outcome);
+            probs.push_back(probability);
+        });
+        return ProbabilitySpace<Outcome>(SORTED_UNIQUE, std::move(keys), std::move(probs));
+    }
+};
+
+#endif
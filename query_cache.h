@@ -0,0 +1,222 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "probability_space.h"
+
+
+// Counters of a QueryCache, for tuning its capacity
+struct QueryCacheStats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+};
+
+/**
+ * @brief Bounded memo of the results of repeated queries on one space.
+ *
+ * Results are keyed by a 64-bit fingerprint of the events, the query kind and the
+ * mode of the space. Hits still compare the stored events with the queried ones, so
+ * a fingerprint collision can only cost a miss, never a wrong answer. Every result
+ * also records the version of the space it was computed at; spaces with a version()
+ * such as MutableProbabilitySpace invalidate all older results by mutating, spaces
+ * without one never change.
+ *
+ * The cache is split into shards by fingerprint, each with a fixed number of slots
+ * and CLOCK eviction. Lookups only take a shared lock on their shard and mark a hit
+ * with an atomic flag, so concurrent readers don't serialize. Results are computed
+ * outside of any lock and only inserting them takes the shard exclusively.
+ * Exceptions from the space propagate and nothing is cached for them.
+ *
+ * @tparam T The type of outcomes. It needs a std::hash specialization.
+ * @tparam Space ProbabilitySpace<T> or MutableProbabilitySpace<T>.
+ */
+template <typename T, typename Space = ProbabilitySpace<T>>
+class QueryCache {
+private:
+    using Event = std::set<T>;
+
+    static constexpr std::size_t SHARDS = 16;
+
+    struct Slot {
+        std::uint64_t fingerprint = 0;
+        std::uint64_t version = 0;
+        bool mode = false;
+        bool conditional = false;
+        bool used = false;
+        Event eventA;
+        Event eventB;
+        double value = 0.0;
+        std::atomic<bool> referenced{false};
+    };
+
+    struct alignas(64) Shard {
+        std::shared_mutex mutex;
+        std::unique_ptr<Slot[]> slots;
+        std::unordered_map<std::uint64_t, std::size_t> index;
+        std::size_t hand = 0;
+    };
+
+    const Space& space;
+    std::size_t slotsPerShard;
+    std::unique_ptr<Shard[]> shards;
+    mutable std::atomic<std::uint64_t> hits{0};
+    mutable std::atomic<std::uint64_t> misses{0};
+    mutable std::atomic<std::uint64_t> evictions{0};
+
+    static std::uint64_t mix(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static std::uint64_t fingerprintOf(const Event& event) {
+        std::uint64_t h = mix(event.size() + 0x9e3779b97f4a7c15ull);
+        for (const auto& outcome : event) h = mix(h ^ std::hash<T>{}(outcome));
+        return h;
+    }
+
+    // Spaces without a version never change, spaces without a mode never ignore outcomes
+    template <typename S>
+    static auto versionOf(const S& s, int) -> decltype(std::uint64_t(s.version())) { return s.version(); }
+    template <typename S>
+    static std::uint64_t versionOf(const S&, long) { return 0; }
+    template <typename S>
+    static auto modeOf(const S& s, int) -> decltype(bool(s.getCurrentMode())) { return s.getCurrentMode(); }
+    template <typename S>
+    static bool modeOf(const S&, long) { return false; }
+
+    bool matches(const Slot& slot, std::uint64_t fingerprint, std::uint64_t version, bool mode,
+                 const Event& eventA, const Event* eventB) const {
+        return slot.used && slot.fingerprint == fingerprint && slot.version == version && slot.mode == mode &&
+               slot.conditional == (eventB != nullptr) && slot.eventA == eventA && (!eventB || slot.eventB == *eventB);
+    }
+
+    template <typename Compute>
+    double lookup(const Event& eventA, const Event* eventB, Compute compute) const {
+        std::uint64_t version = versionOf(space, 0);
+        bool mode = modeOf(space, 0);
+        std::uint64_t fingerprint = fingerprintOf(eventA);
+        if (eventB) fingerprint = mix(fingerprint ^ mix(fingerprintOf(*eventB) + 1));
+        fingerprint = mix(fingerprint ^ (mode ? 0x5bd1e995ull : 0));
+        Shard& shard = shards[fingerprint % SHARDS];
+
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.index.find(fingerprint);
+            if (it != shard.index.end()) {
+                Slot& slot = shard.slots[it->second];
+                if (matches(slot, fingerprint, version, mode, eventA, eventB)) {
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return slot.value;
+                }
+            }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        double value = compute();
+
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        std::size_t target;
+        auto it = shard.index.find(fingerprint);
+        if (it != shard.index.end()) {
+            // A stale result or a colliding event takes the place of the old one
+            target = it->second;
+        }
+        else {
+            // CLOCK: skip slots hit since the hand last passed them
+            while (shard.slots[shard.hand].referenced.exchange(false, std::memory_order_relaxed))
+                shard.hand = (shard.hand + 1) % slotsPerShard;
+            target = shard.hand;
+            shard.hand = (shard.hand + 1) % slotsPerShard;
+            if (shard.slots[target].used) {
+                shard.index.erase(shard.slots[target].fingerprint);
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+            shard.index.emplace(fingerprint, target);
+        }
+        Slot& slot = shard.slots[target];
+        slot.fingerprint = fingerprint;
+        slot.version = version;
+        slot.mode = mode;
+        slot.conditional = eventB != nullptr;
+        slot.used = true;
+        slot.eventA = eventA;
+        slot.eventB = eventB ? *eventB : Event();
+        slot.value = value;
+        slot.referenced.store(false, std::memory_order_relaxed);
+        return value;
+    }
+
+public:
+    /**
+     * @brief Create an empty cache in front of a space.
+     *
+     * @param space The space to answer queries with. It must outlive the cache.
+     * @param capacity Maximum number of cached results, rounded up to a multiple of
+     * the number of shards.
+     */
+    explicit QueryCache(const Space& space, std::size_t capacity = 1024)
+        : space(space), slotsPerShard(std::max<std::size_t>(1, (capacity + SHARDS - 1) / SHARDS)),
+          shards(new Shard[SHARDS]) {
+        for (std::size_t s = 0; s < SHARDS; ++s) {
+            shards[s].slots.reset(new Slot[slotsPerShard]);
+            shards[s].index.reserve(slotsPerShard);
+        }
+    }
+
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    std::size_t capacity() const {
+        return slotsPerShard * SHARDS;
+    }
+
+    // Cached space.probabilityOfSet(event)
+    double probabilityOfSet(const Event& event) const {
+        return lookup(event, nullptr, [&]{ return space.probabilityOfSet(event); });
+    }
+
+    // Cached space.conditionalProbability(eventA, eventB)
+    double conditionalProbability(const Event& eventA, const Event& eventB) const {
+        return lookup(eventA, &eventB, [&]{ return space.conditionalProbability(eventA, eventB); });
+    }
+
+    QueryCacheStats stats() const {
+        QueryCacheStats result;
+        result.hits = hits.load(std::memory_order_relaxed);
+        result.misses = misses.load(std::memory_order_relaxed);
+        result.evictions = evictions.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    // Drop every cached result and reset the counters.
+    void clear() {
+        for (std::size_t s = 0; s < SHARDS; ++s) {
+            std::unique_lock<std::shared_mutex> lock(shards[s].mutex);
+            shards[s].slots.reset(new Slot[slotsPerShard]);
+            shards[s].index.clear();
+            shards[s].hand = 0;
+        }
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef RANDOM_VARIABLE_H
+#define RANDOM_VARIABLE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "probability_space.h"
+
+// Number of outcomes processed per block by the fused batch kernels. A block of
+// probabilities stays in L1 while every variable of the batch is accumulated. It is
+// a multiple of 4, so blocked sums add their terms to the lanes of addToLanes() in
+// exactly the order of a single pass.
+constexpr std::size_t MOMENT_BLOCK = 1024;
+
+// Add term(i) over [begin, end) to the lane i mod 4, and the terms past the last full
+// group of 4 to lane 0. Four independent accumulators break the dependency chain of a
+// single running sum and map onto the SIMD lanes the compiler vectorizes the loop with.
+// begin must be a multiple of 4; calls over consecutive ranges then accumulate as one
+// call over their union as long as only the last range has a partial group.
+template <typename Term>
+inline void addToLanes(double* lanes, std::size_t begin, std::size_t end, Term term) {
+    std::size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        lanes[0] += term(i);
+        lanes[1] += term(i + 1);
+        lanes[2] += term(i + 2);
+        lanes[3] += term(i + 3);
+    }
+    for (; i < end; ++i) lanes[0] += term(i);
+}
+
+// Lanes are added up in a fixed order, so results don't depend on the build
+inline double sumOfLanes(const double* lanes) {
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// Sum of weights[i] * values[i] over [0, size)
+inline double dotProduct(const double* weights, const double* values, std::size_t size) {
+    double lanes[4] = {0.0, 0.0, 0.0, 0.0};
+    addToLanes(lanes, 0, size, [&](std::size_t i) { return weights[i] * values[i]; });
+    return sumOfLanes(lanes);
+}
+
+// prob * (value - shift)^power, the term of a moment around shift
+inline double shiftedTerm(double prob, double value, double shift, unsigned power) {
+    double d = value - shift;
+    double p = 1.0;
+    for (unsigned e = 0; e < power; ++e) p *= d;
+    return prob * p;
+}
+
+/**
+ * @brief A real-valued function of the outcomes of a probability space.
+ *
+ * The values are evaluated once and stored as a contiguous array aligned with the
+ * dense storage of the space, so values[i] belongs to the i-th outcome. Expectations
+ * and moments are then dot products with the probabilities of the space and never
+ * look up an outcome. The variable keeps a copy of the space, which shares its
+ * storage, so it stays valid on its own.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class RandomVariable {
+private:
+    ProbabilitySpace<T> space;
+    std::vector<double> values;
+
+    // E[(X - shift)^power] in one pass
+    double shiftedMoment(double shift, unsigned power) const {
+        const double* probs = space.probabilityData();
+        double lanes[4] = {0.0, 0.0, 0.0, 0.0};
+        addToLanes(lanes, 0, values.size(), [&](std::size_t k) { return shiftedTerm(probs[k], values[k], shift, power); });
+        return sumOfLanes(lanes);
+    }
+
+    double conditioned(const ValidatedEvent<T>& eventB, double probB) const {
+        if (probB == 0)
+            throw std::invalid_argument("Tried to calculate conditional expectation E[X|B] with B s.t. P(B)=0");
+        const double* probs = space.probabilityData();
+        double sum = 0.0;
+        for (std::size_t i : eventB.outcomeIndices()) sum += probs[i] * values[i];
+        return sum / probB;
+    }
+
+public:
+    /**
+     * @brief Evaluate f at every outcome of a space.
+     *
+     * @param space The probability space the variable is defined on.
+     * @param f Callable mapping an outcome to a double.
+     */
+    template <typename F>
+    RandomVariable(const ProbabilitySpace<T>& space, F f) : space(space), values(space.size()) {
+        for (std::size_t i = 0; i < values.size(); ++i) values[i] = f(space.outcomeAt(i));
+    }
+
+    /**
+     * @brief Take the values of the variable as they are.
+     *
+     * @param values values[i] is the value at the i-th outcome of the space in ascending order.
+     * @throws std::invalid_argument if there isn't exactly one value per outcome.
+     */
+    RandomVariable(const ProbabilitySpace<T>& space, std::vector<double> values)
+        : space(space), values(std::move(values)) {
+        if (this->values.size() != space.size())
+            throw std::invalid_argument("Every outcome needs exactly one value");
+    }
+
+    const ProbabilitySpace<T>& probabilitySpace() const {
+        return space;
+    }
+
+    // Values aligned with the outcomes of the space
+    const std::vector<double>& valueData() const {
+        return values;
+    }
+
+    // E[X]
+    double expectation() const {
+        return dotProduct(space.probabilityData(), values.data(), values.size());
+    }
+
+    // Var[X], summed around the mean so that large offsets don't cancel
+    double variance() const {
+        return shiftedMoment(expectation(), 2);
+    }
+
+    double standardDeviation() const {
+        return std::sqrt(variance());
+    }
+
+    // E[X^k]
+    double moment(unsigned k) const {
+        return shiftedMoment(0.0, k);
+    }
+
+    // E[(X - E[X])^k]
+    double centralMoment(unsigned k) const {
+        return shiftedMoment(expectation(), k);
+    }
+
+    /**
+     * @brief Calculate E[X | B].
+     *
+     * @throws std::invalid_argument if B contains an outcome not in the sample space,
+     * unless the space ignores unknown outcomes, or if P(B)=0.
+     */
+    double conditionalExpectation(const std::set<T>& eventB) const {
+        ValidatedEvent<T> validated = space.validate(eventB);
+        return conditioned(validated, space.probabilityOfSet(validated));
+    }
+
+    /**
+     * @brief Calculate E[X | B] for a condition validated by the space of the variable.
+     *
+     * @throws std::invalid_argument if B belongs to another space or P(B)=0.
+     */
+    double conditionalExpectation(const ValidatedEvent<T>& eventB) const {
+        return conditioned(eventB, space.probabilityOfSet(eventB));
+    }
+};
+
+// Probabilities shared by all variables of a batch
+template <typename T>
+const double* batchProbabilities(const std::vector<RandomVariable<T>>& variables) {
+    const double* probs = variables[0].probabilitySpace().probabilityData();
+    for (const auto& variable : variables) {
+        if (variable.probabilitySpace().probabilityData() != probs)
+            throw std::invalid_argument("Random variables belong to different sample spaces");
+    }
+    return probs;
+}
+
+// E[(X_v - shifts[v])^power] for all variables in one blocked pass
+template <typename T>
+std::vector<double> shiftedMoments(const std::vector<RandomVariable<T>>& variables, const double* probs,
+                                   const std::vector<double>& shifts, unsigned power) {
+    std::size_t n = variables[0].valueData().size();
+    std::vector<double> lanes(4 * variables.size(), 0.0);
+    for (std::size_t begin = 0; begin < n; begin += MOMENT_BLOCK) {
+        std::size_t end = std::min(n, begin + MOMENT_BLOCK);
+        for (std::size_t v = 0; v < variables.size(); ++v) {
+            const double* values = variables[v].valueData().data();
+            double shift = shifts[v];
+            addToLanes(lanes.data() + 4 * v, begin, end,
+                       [&](std::size_t k) { return shiftedTerm(probs[k], values[k], shift, power); });
+        }
+    }
+    std::vector<double> result(variables.size());
+    for (std::size_t v = 0; v < variables.size(); ++v)
+        result[v] = sumOfLanes(lanes.data() + 4 * v);
+    return result;
+}
+
+/**
+ * @brief Calculate the expectations of several variables on the same space in one fused pass.
+ *
+ * The outcomes are walked in blocks; every block of probabilities is read from memory
+ * once and reused from cache for all variables, instead of once per variable. Each
+ * expectation is summed in the order of expectation(), so the results are bit for bit
+ * the same as separate calls.
+ *
+ * @throws std::invalid_argument if the variables are not all defined on the same space.
+ */
+template <typename T>
+std::vector<double> expectations(const std::vector<RandomVariable<T>>& variables) {
+    if (variables.empty()) return {};
+    const double* probs = batchProbabilities(variables);
+    // p * (x - 0)^1 is p * x exactly, the term of expectation()
+    return shiftedMoments(variables, probs, std::vector<double>(variables.size(), 0.0), 1);
+}
+
+/**
+ * @brief Calculate the variances of several variables on the same space in two fused passes.
+ *
+ * The first pass finds the means as expectations() does, the second sums around them
+ * like variance(), so the results are bit for bit the same as separate calls.
+ *
+ * @throws std::invalid_argument if the variables are not all defined on the same space.
+ */
+template <typename T>
+std::vector<double> variances(const std::vector<RandomVariable<T>>& variables) {
+    if (variables.empty()) return {};
+    const double* probs = batchProbabilities(variables);
+    return shiftedMoments(variables, probs, expectations(variables), 2);
+}
+
+#endif
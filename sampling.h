@@ -0,0 +1,181 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+#include "probability_space.h"
+#include "executor.h"
+
+// Number of uniforms generated at once by the bulk samplers
+constexpr std::size_t SAMPLE_BLOCK = 256;
+
+/**
+ * @brief Draw a uniform double in [0, 1) from any uniform random bit generator.
+ */
+template <typename URBG>
+double uniformUnit(URBG& rng) {
+    double u = std::generate_canonical<double, std::numeric_limits<double>::digits>(rng);
+    // generate_canonical may round up to 1 for some generators
+    return u < 1.0 ? u : std::nextafter(1.0, 0.0);
+}
+
+/**
+ * @brief Create stream i of a family of independent random number streams.
+ *
+ * The stream is seeded from (seed, i), so the same seed always gives the same
+ * streams no matter how many of them are created or which thread uses them.
+ */
+inline std::mt19937_64 makeStream(std::uint64_t seed, std::uint64_t i) {
+    std::seed_seq sequence{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+                           static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(i >> 32)};
+    return std::mt19937_64(sequence);
+}
+
+// Create the first count streams of a family, e.g. one per thread.
+inline std::vector<std::mt19937_64> makeStreams(std::uint64_t seed, std::size_t count) {
+    std::vector<std::mt19937_64> streams;
+    streams.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) streams.push_back(makeStream(seed, i));
+    return streams;
+}
+
+/**
+ * @brief Sampler drawing outcomes of a probability space in O(1) per draw.
+ *
+ * Builds a Walker/Vose alias table once in O(n). Every draw then takes one uniform
+ * random number, one table lookup and one comparison. The space must outlive the
+ * sampler; the sampler itself is immutable and can be shared between threads as
+ * long as each thread uses its own random number generator.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class AliasSampler {
+private:
+    const ProbabilitySpace<T>* space;
+    // Column i keeps outcome i with probability threshold[i] and returns alias[i] otherwise
+    std::vector<double> threshold;
+    std::vector<std::size_t> alias;
+
+    std::size_t column(double u) const {
+        double x = u * static_cast<double>(threshold.size());
+        std::size_t i = std::min(static_cast<std::size_t>(x), threshold.size() - 1);
+        return (x - static_cast<double>(i)) < threshold[i] ? i : alias[i];
+    }
+
+public:
+    /**
+     * @brief Build the alias table of a probability space.
+     *
+     * The construction of the space already guarantees a proper distribution, so the
+     * table needs no further validation.
+     */
+    explicit AliasSampler(const ProbabilitySpace<T>& space)
+        : space(&space), threshold(space.size()), alias(space.size()) {
+        std::size_t n = space.size();
+        std::vector<double> scaled(n);
+        std::vector<std::size_t> small;
+        std::vector<std::size_t> large;
+        for (std::size_t i = 0; i < n; ++i) {
+            scaled[i] = space.probabilityAt(i) * static_cast<double>(n);
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            std::size_t s = small.back();
+            std::size_t l = large.back();
+            small.pop_back();
+            threshold[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // What is left over only differs from 1 by rounding
+        for (auto i : large) { threshold[i] = 1.0; alias[i] = i; }
+        for (auto i : small) { threshold[i] = 1.0; alias[i] = i; }
+    }
+
+    // Draw the index of one outcome in the dense storage of the space.
+    template <typename URBG>
+    std::size_t sampleIndex(URBG& rng) const {
+        return column(uniformUnit(rng));
+    }
+
+    template <typename URBG>
+    const T& operator()(URBG& rng) const {
+        return space->outcomeAt(sampleIndex(rng));
+    }
+
+    /**
+     * @brief Draw n outcomes into an output iterator.
+     *
+     * Uniforms are generated in blocks ahead of the table lookups, which keeps the
+     * lookup loop free of calls into the generator.
+     */
+    template <typename URBG, typename OutputIt>
+    void sample(std::size_t n, URBG& rng, OutputIt out) const {
+        double uniforms[SAMPLE_BLOCK];
+        while (n > 0) {
+            std::size_t block = std::min(n, SAMPLE_BLOCK);
+            for (std::size_t k = 0; k < block; ++k) uniforms[k] = uniformUnit(rng);
+            for (std::size_t k = 0; k < block; ++k) *out++ = space->outcomeAt(column(uniforms[k]));
+            n -= block;
+        }
+    }
+
+    /**
+     * @brief Draw n outcomes into out[0..n) across the threads of an executor.
+     *
+     * The draws are split into fixed blocks and block b always uses stream b of
+     * makeStream(seed, b), so the output only depends on the seed and not on the
+     * number of threads.
+     */
+    void sampleParallel(std::size_t n, std::uint64_t seed, T* out, WorkStealingExecutor& executor) const {
+        constexpr std::size_t PARALLEL_BLOCK = 1 << 16;
+        std::size_t blocks = (n + PARALLEL_BLOCK - 1) / PARALLEL_BLOCK;
+        executor.forEachChunk(blocks, 1, [&](std::size_t begin, std::size_t) {
+            std::mt19937_64 rng = makeStream(seed, begin);
+            std::size_t first = begin * PARALLEL_BLOCK;
+            sample(std::min(PARALLEL_BLOCK, n - first), rng, out + first);
+        });
+    }
+};
+
+/**
+ * @brief Sampler drawing outcomes of a probability space by inverting its CDF.
+ *
+ * Needs no setup beyond the prefix sums of the space and takes a binary search
+ * per draw. Sorting the uniforms first yields the outcomes in ascending order.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class InverseCdfSampler {
+private:
+    const ProbabilitySpace<T>* space;
+
+public:
+    explicit InverseCdfSampler(const ProbabilitySpace<T>& space) : space(&space) {}
+
+    // Inverting at u in (0, 1] instead of [0, 1) never lands on an outcome of probability 0.
+    template <typename URBG>
+    const T& operator()(URBG& rng) const {
+        return space->quantile(1.0 - uniformUnit(rng));
+    }
+
+    template <typename URBG, typename OutputIt>
+    void sample(std::size_t n, URBG& rng, OutputIt out) const {
+        for (std::size_t k = 0; k < n; ++k) *out++ = (*this)(rng);
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+
+/**
+ * @brief A monotonic memory resource that keeps its blocks when it is reset.
+ *
+ * Allocation bumps a pointer through the current block and deallocation does
+ * nothing. reset() rewinds to the first block but, unlike
+ * std::pmr::monotonic_buffer_resource::release(), returns no memory upstream, so
+ * once the arena has grown to the size a workload needs, resetting and refilling
+ * it never calls malloc again. An arena must only be used by one thread at a time.
+ */
+class ScratchArena : public std::pmr::memory_resource {
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> memory;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks;
+    std::size_t current = 0;
+    std::size_t used = 0;
+    std::size_t initialSize;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        for (;;) {
+            if (current < blocks.size()) {
+                std::uintptr_t base = reinterpret_cast<std::uintptr_t>(blocks[current].memory.get());
+                std::uintptr_t start = (base + used + alignment - 1) / alignment * alignment;
+                if (start + bytes <= base + blocks[current].size) {
+                    used = start + bytes - base;
+                    return reinterpret_cast<void*>(start);
+                }
+                if (current + 1 < blocks.size()) {
+                    ++current;
+                    used = 0;
+                    continue;
+                }
+            }
+            // Grow geometrically so the number of blocks stays logarithmic
+            std::size_t size = std::max(bytes + alignment, blocks.empty() ? initialSize : 2 * blocks.back().size);
+            blocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+            current = blocks.size() - 1;
+            used = 0;
+        }
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    explicit ScratchArena(std::size_t initialSize = std::size_t{64} << 10) : initialSize(initialSize) {}
+
+    // Make all memory available again. Everything allocated before is invalidated.
+    void reset() {
+        current = 0;
+        used = 0;
+    }
+
+    // Bytes held by the arena, in use or not
+    std::size_t capacity() const {
+        std::size_t total = 0;
+        for (const auto& block : blocks) total += block.size;
+        return total;
+    }
+};
+
+/**
+ * @brief The scratch arena of the calling thread, for the temporaries of queries.
+ *
+ * Allocations from it are only valid until the outermost ScratchScope of the
+ * thread ends.
+ */
+inline ScratchArena& scratchArena() {
+    thread_local ScratchArena arena;
+    return arena;
+}
+
+/**
+ * @brief Marks a query or batch using the scratch arena of the calling thread.
+ *
+ * Scopes nest; the arena is reset when the outermost one ends, so the memory of
+ * one query or batch is reused by the next.
+ */
+class ScratchScope {
+private:
+    static std::size_t& depth() {
+        thread_local std::size_t scopes = 0;
+        return scopes;
+    }
+
+public:
+    ScratchScope() { ++depth(); }
+
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+    ~ScratchScope() {
+        if (--depth() == 0) scratchArena().reset();
+    }
+
+    std::pmr::memory_resource* resource() const { return &scratchArena(); }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef STATIC_PROBABILITY_SPACE_H
+#define STATIC_PROBABILITY_SPACE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+
+#include "probability_space.h"
+
+
+/**
+ * @brief A probability space with a small sample space fixed at compile time.
+ *
+ * Outcomes and probabilities live in std::array, so the space needs no heap
+ * allocation and can be built in constexpr contexts. Building a constexpr space
+ * from an invalid distribution stops compilation, since the validation throws
+ * during constant evaluation. Events are uint64_t masks where bit i stands for
+ * the i-th outcome given to the constructor, so P(E) is a short loop over at
+ * most 64 probabilities.
+ *
+ * @tparam T The type of outcomes, a literal type such as an integer or enum.
+ * @tparam N The number of outcomes, at most 64.
+ */
+template <typename T, std::size_t N>
+class StaticProbabilitySpace {
+    static_assert(N > 0 && N <= 64, "StaticProbabilitySpace supports between 1 and 64 outcomes");
+
+private:
+    std::array<T, N> outcomes{};
+    std::array<double, N> probabilities{};
+
+    static constexpr std::uint64_t FULL = N == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << N) - 1;
+
+public:
+    using Event = std::uint64_t;
+
+    /**
+     * @brief Construct a probability space from a list of outcomes and their probabilities.
+     *
+     * @param mapping N pairs of distinct outcomes and their probabilities.
+     * @throws std::invalid_argument if an outcome is repeated, a probability is negative or
+     * the probabilities don't sum up to one. In a constexpr context this is a compile error.
+     */
+    constexpr explicit StaticProbabilitySpace(const std::pair<T, double> (&mapping)[N]) {
+        double total = 0.0;
+        for (std::size_t i = 0; i < N; ++i) {
+            for (std::size_t j = 0; j < i; ++j) {
+                if (outcomes[j] == mapping[i].first) throw std::invalid_argument("Outcomes must be unique");
+            }
+            if (mapping[i].second < 0.0) throw std::invalid_argument("Probabilities must be nonnegative");
+            outcomes[i] = mapping[i].first;
+            probabilities[i] = mapping[i].second;
+            total += mapping[i].second;
+        }
+        double error = total > 1.0 ? total - 1.0 : 1.0 - total;
+        if (error > sumTolerance(N)) throw std::invalid_argument("Probabilities must sum to 1");
+    }
+
+    static constexpr std::size_t size() { return N; }
+
+    // The event containing every outcome
+    static constexpr Event all() { return FULL; }
+
+    /**
+     * @brief Build the mask of an event from its outcomes.
+     *
+     * @throws std::invalid_argument if an outcome is not in the sample space.
+     */
+    constexpr Event maskOf(std::initializer_list<T> event) const {
+        Event mask = 0;
+        for (const T& outcome : event) {
+            std::size_t i = 0;
+            while (i < N && !(outcomes[i] == outcome)) ++i;
+            if (i == N) throw std::invalid_argument("Event contains outcome not in sample space");
+            mask |= Event{1} << i;
+        }
+        return mask;
+    }
+
+    /**
+     * @brief Calculate the probability of an event mask.
+     *
+     * @throws std::invalid_argument if the mask has bits beyond the N outcomes.
+     */
+    constexpr double probabilityOf(Event event) const {
+        if (event & ~FULL) throw std::invalid_argument("Event contains outcome not in sample space");
+        double total = 0.0;
+        for (std::size_t i = 0; i < N; ++i) {
+            if ((event >> i) & 1) total += probabilities[i];
+        }
+        return total;
+    }
+
+    constexpr double probabilityOfSet(std::initializer_list<T> event) const {
+        return probabilityOf(maskOf(event));
+    }
+
+    constexpr double complementOfEvent(Event event) const {
+        return 1.0 - probabilityOf(event);
+    }
+
+    constexpr double unionOfEvents(Event eventA, Event eventB) const {
+        return probabilityOf(eventA | eventB);
+    }
+
+    constexpr double intersectionOfEvents(Event eventA, Event eventB) const {
+        return probabilityOf(eventA & eventB);
+    }
+
+    // Calculate P(A|B), throw exception if P(B)=0
+    constexpr double conditionalProbability(Event eventA, Event eventB) const {
+        double probB = probabilityOf(eventB);
+        if (probB == 0)
+            throw std::invalid_argument("Tried to calculate conditional probability P(A|B) with B s.t. P(B)=0");
+        return probabilityOf(eventA & eventB) / probB;
+    }
+
+    constexpr const T& outcomeAt(std::size_t index) const { return outcomes[index]; }
+
+    constexpr double probabilityAt(std::size_t index) const { return probabilities[index]; }
+};
+
+#endif
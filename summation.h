@@ -0,0 +1,130 @@
+#ifndef SUMMATION_H
+#define SUMMATION_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "executor.h"
+
+
+// Number of terms per block of a reproducible sum. Blocks are cut by the position
+// of a term in the sum, never by the number of threads working on it.
+constexpr std::size_t SUM_BLOCK = 4096;
+
+/*
+ * Summation policies. A policy is an accumulator with add() for the next term,
+ * merge() for the accumulator of the terms following its own and result(). Every
+ * policy performs a fixed sequence of floating-point operations for a given
+ * sequence of terms, so a sum doesn't depend on the build or the machine.
+ */
+
+// Left-to-right sum: fastest, with an error growing linearly in the number of terms
+struct NaiveSum {
+    double sum = 0.0;
+
+    void add(double x) { sum += x; }
+    void merge(const NaiveSum& other) { sum += other.sum; }
+    double result() const { return sum; }
+};
+
+// Neumaier's compensated sum: the error doesn't grow with the number of terms
+struct NeumaierSum {
+    double sum = 0.0;
+    double compensation = 0.0;
+
+    void add(double x) {
+        double t = sum + x;
+        compensation += std::abs(sum) >= std::abs(x) ? (sum - t) + x : (x - t) + sum;
+        sum = t;
+    }
+
+    void merge(const NeumaierSum& other) {
+        add(other.sum);
+        compensation += other.compensation;
+    }
+
+    double result() const { return sum + compensation; }
+};
+
+// Pairwise sum over a binary counter of partial sums: partials[k] holds the sum of
+// 2^k terms, so the error grows with the logarithm of the number of terms
+struct PairwiseSum {
+    double partials[64];
+    std::uint64_t filled = 0;
+
+    void add(double x) {
+        unsigned level = 0;
+        for (; filled & (std::uint64_t{1} << level); ++level) {
+            x = partials[level] + x;
+            filled &= ~(std::uint64_t{1} << level);
+        }
+        partials[level] = x;
+        filled |= std::uint64_t{1} << level;
+    }
+
+    void merge(const PairwiseSum& other) { add(other.result()); }
+
+    double result() const {
+        double total = 0.0;
+        for (unsigned level = 0; level < 64; ++level) {
+            if (filled & (std::uint64_t{1} << level)) total += partials[level];
+        }
+        return total;
+    }
+};
+
+/**
+ * @brief A sum cut into blocks of SUM_BLOCK terms that are merged in order.
+ *
+ * Each block is summed with a fresh accumulator of the policy and merged into the
+ * total when it is full. reproducibleSum() computes the blocks on different threads
+ * and merges them in the same order, so serial and parallel sums agree to the bit
+ * for any number of threads. Sums of at most SUM_BLOCK terms are the plain sums of
+ * the policy.
+ *
+ * @tparam Sum The summation policy.
+ */
+template <typename Sum>
+class BlockedSum {
+private:
+    Sum total;
+    Sum block;
+    std::size_t count = 0;
+
+public:
+    void add(double x) {
+        block.add(x);
+        if (++count == SUM_BLOCK) {
+            total.merge(block);
+            block = Sum();
+            count = 0;
+        }
+    }
+
+    double result() const {
+        Sum whole = total;
+        if (count > 0) whole.merge(block);
+        return whole.result();
+    }
+};
+
+/**
+ * @brief Sum term(i) over [0, n) with the blocks of a BlockedSum spread over an executor.
+ *
+ * @return Bit for bit the result of adding the terms to a BlockedSum<Sum> in order.
+ */
+template <typename Sum, typename Term>
+double reproducibleSum(std::size_t n, Term term, WorkStealingExecutor& executor) {
+    std::vector<Sum> blocks((n + SUM_BLOCK - 1) / SUM_BLOCK);
+    executor.forEachChunk(n, SUM_BLOCK, [&](std::size_t begin, std::size_t end) {
+        Sum& block = blocks[begin / SUM_BLOCK];
+        for (std::size_t i = begin; i < end; ++i) block.add(term(i));
+    });
+    Sum total;
+    for (const auto& block : blocks) total.merge(block);
+    return total.result();
+}
+
+#endif
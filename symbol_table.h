@@ -0,0 +1,159 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "probability_space.h"
+
+
+// ID of an outcome: its position in the dense storage of its space
+using OutcomeId = std::uint32_t;
+
+constexpr OutcomeId NO_OUTCOME = std::numeric_limits<OutcomeId>::max();
+
+/**
+ * @brief Hashed lookup of the outcomes of a probability space by value.
+ *
+ * Every outcome gets a 32-bit ID, its position in the dense storage of the space.
+ * Labels are mapped to IDs with one hash and, normally, a single comparison with
+ * the outcome itself, and events are built from the IDs as ValidatedEvents, so all
+ * queries on them work on positions and never compare outcomes. For
+ * ProbabilitySpace<std::string> lookups take a std::string_view, so nothing is
+ * copied to look up a label.
+ *
+ * The table stores no outcomes of its own, only IDs together with a tag of their
+ * hash in an open-addressing array. It keeps a copy of the space, which shares its
+ * storage, so it stays valid on its own.
+ *
+ * @tparam T The type of outcomes in the probability space.
+ */
+template <typename T>
+class SymbolTable {
+public:
+    // Type labels are looked up with
+    using Key = std::conditional_t<std::is_same_v<T, std::string>, std::string_view, T>;
+
+private:
+    struct Slot {
+        OutcomeId id = NO_OUTCOME;
+        std::uint32_t tag = 0;
+    };
+
+    ProbabilitySpace<T> space;
+    std::vector<Slot> slots;
+    std::size_t mask = 0;
+
+    static std::uint64_t hashOf(const Key& key) {
+        // Spread the bits, std::hash of integers is often the identity
+        std::uint64_t h = std::hash<Key>{}(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+public:
+    /**
+     * @brief Index every outcome of a space.
+     *
+     * @throws std::invalid_argument if the space has too many outcomes for 32-bit IDs.
+     */
+    explicit SymbolTable(const ProbabilitySpace<T>& space) : space(space) {
+        if (space.size() >= NO_OUTCOME)
+            throw std::invalid_argument("Sample space has too many outcomes for 32-bit IDs");
+        // At most half full, so probe sequences stay short
+        std::size_t capacity = 2;
+        while (capacity < 2 * space.size()) capacity *= 2;
+        slots.resize(capacity);
+        mask = capacity - 1;
+        for (std::size_t i = 0; i < space.size(); ++i) {
+            std::uint64_t h = hashOf(Key(space.outcomeAt(i)));
+            std::size_t s = h & mask;
+            while (slots[s].id != NO_OUTCOME) s = (s + 1) & mask;
+            slots[s].id = static_cast<OutcomeId>(i);
+            slots[s].tag = static_cast<std::uint32_t>(h >> 32);
+        }
+        PROBABILITY_ENGINE_COUNT_BYTES(slots.capacity() * sizeof(Slot));
+    }
+
+    const ProbabilitySpace<T>& probabilitySpace() const {
+        return space;
+    }
+
+    // Number of outcomes with an ID
+    std::size_t size() const {
+        return space.size();
+    }
+
+    // ID of an outcome, or NO_OUTCOME if it is not in the sample space
+    OutcomeId find(const Key& key) const noexcept {
+        std::uint64_t h = hashOf(key);
+        std::uint32_t tag = static_cast<std::uint32_t>(h >> 32);
+        for (std::size_t s = h & mask; slots[s].id != NO_OUTCOME; s = (s + 1) & mask) {
+            if (slots[s].tag == tag && Key(space.outcomeAt(slots[s].id)) == key) return slots[s].id;
+        }
+        return NO_OUTCOME;
+    }
+
+    /**
+     * @brief ID of an outcome.
+     *
+     * @throws std::invalid_argument if the outcome is not in the sample space.
+     */
+    OutcomeId id(const Key& key) const {
+        OutcomeId result = find(key);
+        if (result == NO_OUTCOME) throw std::invalid_argument("Event contains outcome not in sample space");
+        return result;
+    }
+
+    const T& outcome(OutcomeId id) const {
+        return space.outcomeAt(id);
+    }
+
+    double probability(OutcomeId id) const {
+        return space.probabilityAt(id);
+    }
+
+    /**
+     * @brief Build an event of the space from the IDs of its outcomes.
+     *
+     * @param ids IDs in any order. Duplicates are dropped.
+     * @throws std::invalid_argument if an ID is not one of the space.
+     */
+    ValidatedEvent<T> eventOf(const std::vector<OutcomeId>& ids) const {
+        return space.validateIndices(std::vector<std::size_t>(ids.begin(), ids.end()));
+    }
+
+    /**
+     * @brief Build an event of the space from a range of labels in any order.
+     *
+     * @return An event that can be queried on probabilitySpace(). Labels not in the
+     * sample space are dropped if the space ignores unknown outcomes.
+     * @throws std::invalid_argument if a label is not in the sample space.
+     */
+    template <typename It>
+    ValidatedEvent<T> eventOf(It first, It last) const {
+        std::vector<std::size_t> indices;
+        for (; first != last; ++first) {
+            OutcomeId found = find(Key(*first));
+            if (found != NO_OUTCOME) indices.push_back(found);
+            else if (!space.getCurrentMode()) throw std::invalid_argument("Event contains outcome not in sample space");
+        }
+        return space.validateIndices(std::move(indices));
+    }
+
+    ValidatedEvent<T> eventOf(std::initializer_list<Key> keys) const {
+        return eventOf(keys.begin(), keys.end());
+    }
+};
+
+#endif
@@ -1,9 +1,35 @@
+// The tests also cover the query instrumentation, which is off by default
+#define PROBABILITY_ENGINE_INSTRUMENTATION
 #include "probability_space.h"
+#include "sampling.h"
+#include "mutable_probability_space.h"
+#include "static_probability_space.h"
+#include "probability_space_io.h"
+#include "probability_space_builder.h"
+#include "product_space.h"
+#include "random_variable.h"
+#include "query_cache.h"
+#include "symbol_table.h"
+#include "bayesian_updater.h"
+#include "log_probability_space.h"
+#include "distributions.h"
+#include "markov_chain.h"
+#include "divergence.h"
 #include <iostream>
 #include <map>
 #include <cassert>
 #include <string>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <memory>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <limits>
+#include <memory_resource>
 
 constexpr int SHOULD_WORK = 0;
 constexpr int SHOULD_FAIL = 1;
@@ -13,6 +39,21 @@ constexpr int COMPLEMENT = 1;
 constexpr int UNION = 2;
 constexpr int INTERSECTION = 3;
 constexpr int CONDITIONAL = 4;
+constexpr int MASK = 5;
+constexpr int MASK_COMPLEMENT = 6;
+constexpr int MASK_UNION = 7;
+constexpr int MASK_INTERSECTION = 8;
+constexpr int MASK_CONDITIONAL = 9;
+constexpr int RANGE = 10;
+constexpr int RANGE_COMPLEMENT = 11;
+constexpr int RANGE_UNION = 12;
+constexpr int RANGE_INTERSECTION = 13;
+constexpr int RANGE_CONDITIONAL = 14;
+constexpr int VALIDATED = 15;
+constexpr int VALIDATED_COMPLEMENT = 16;
+constexpr int VALIDATED_UNION = 17;
+constexpr int VALIDATED_INTERSECTION = 18;
+constexpr int VALIDATED_CONDITIONAL = 19;
 
 const char* expectedBehavior = "Expected behavior in test: ";
 const char* unexpectedBehavior = "Unexpected behavior in test: ";
@@ -50,6 +91,8 @@ template <typename T>
 void testProbability(const ProbabilitySpace<T>& ps, const std::set<T>& events, double target, int expectedOutcome, std::string testName, 
 		int method, const std::set<T>& eventsB = {}) {
     std::string prefix = "[" + testName + "]: ";
+    std::vector<T> vecA(events.begin(), events.end());
+    std::vector<T> vecB(eventsB.begin(), eventsB.end());
     try {
 	double pError = {};
 
@@ -69,6 +112,51 @@ void testProbability(const ProbabilitySpace<T>& ps, const std::set<T>& events, d
             case CONDITIONAL:
 		pError = std::abs(ps.conditionalProbability(events, eventsB) - target);
                 break;
+            case MASK:
+                pError = std::abs(ps.probabilityOfMask(ps.maskOf(events)) - target);
+                break;
+            case MASK_COMPLEMENT:
+                pError = std::abs(ps.probabilityOfMask(~ps.maskOf(events)) - target);
+                break;
+            case MASK_UNION:
+                pError = std::abs(ps.probabilityOfMask(ps.maskOf(events) | ps.maskOf(eventsB)) - target);
+                break;
+            case MASK_INTERSECTION:
+                pError = std::abs(ps.probabilityOfMask(ps.maskOf(events) & ps.maskOf(eventsB)) - target);
+                break;
+            case MASK_CONDITIONAL:
+                pError = std::abs(ps.conditionalProbabilityOfMask(ps.maskOf(events), ps.maskOf(eventsB)) - target);
+                break;
+            case RANGE:
+                pError = std::abs(ps.probabilityOfSet(vecA.begin(), vecA.end()) - target);
+                break;
+            case RANGE_COMPLEMENT:
+                pError = std::abs(ps.complementOfEvent(vecA.begin(), vecA.end()) - target);
+                break;
+            case RANGE_UNION:
+                pError = std::abs(ps.unionOfEvents(vecA.begin(), vecA.end(), vecB.begin(), vecB.end()) - target);
+                break;
+            case RANGE_INTERSECTION:
+                pError = std::abs(ps.intersectionOfEvents(vecA.begin(), vecA.end(), vecB.begin(), vecB.end()) - target);
+                break;
+            case RANGE_CONDITIONAL:
+                pError = std::abs(ps.conditionalProbability(vecA.begin(), vecA.end(), vecB.begin(), vecB.end()) - target);
+                break;
+            case VALIDATED:
+                pError = std::abs(ps.probabilityOfSet(ps.validate(events)) - target);
+                break;
+            case VALIDATED_COMPLEMENT:
+                pError = std::abs(ps.complementOfEvent(ps.validate(events)) - target);
+                break;
+            case VALIDATED_UNION:
+                pError = std::abs(ps.unionOfEvents(ps.validate(events), ps.validate(eventsB)) - target);
+                break;
+            case VALIDATED_INTERSECTION:
+                pError = std::abs(ps.intersectionOfEvents(ps.validate(events), ps.validate(eventsB)) - target);
+                break;
+            case VALIDATED_CONDITIONAL:
+                pError = std::abs(ps.conditionalProbability(ps.validate(events), ps.validate(eventsB)) - target);
+                break;
 	    default:
 		pError = std::abs(ps.probabilityOfSet(events) - target);
         }
@@ -100,6 +188,53 @@ void testProbability(const ProbabilitySpace<T>& ps, const std::set<T>& events, d
     }
 }
 
+void testBatch(const std::vector<QueryResult>& results, const std::vector<double>& targets,
+               const std::vector<QueryError>& errors, std::string testName) {
+    std::string prefix = "[" + testName + "]: ";
+    if (results.size() != targets.size()) {
+        std::cerr << "[FAILED ]" << prefix << "Batch returned " << results.size() << " results, expected " << targets.size() << "\n";
+        return;
+    }
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        if (results[i].error != errors[i] || (results[i].ok() && std::abs(results[i].probability - targets[i]) >= 1e-9)) {
+            std::cerr << "[FAILED ]" << prefix << "Query " << i << " should have been " << targets[i] << " in " << testName << "\n";
+            return;
+        }
+    }
+    std::cout << "[SUCCESS]" << prefix << expectedBehavior << testName << "\n";
+}
+
+void testValue(double actual, double target, std::string testName) {
+    std::string prefix = "[" + testName + "]: ";
+    if (std::abs(actual - target) < 1e-9) {
+        std::cout << "[SUCCESS]" << prefix << expectedBehavior << testName << "\n";
+    }
+    else {
+        std::cerr << "[FAILED ]" << prefix << "Value should have been " << target << " but was " << actual << " in " << testName << "\n";
+    }
+}
+
+template <typename F>
+void testThrows(F query, std::string testName) {
+    std::string prefix = "[" + testName + "]: ";
+    try {
+        query();
+        std::cerr << "[FAILED ]" << prefix << unexpectedBehavior << testName << ", should have raised an exception\n";
+    }
+    catch (const std::invalid_argument& e) {
+        std::cout << "[SUCCESS]" << prefix << expectedBehavior << testName << std::endl;
+        std::cerr << "\t " << prefix << "Caught exception: " << e.what() << std::endl;
+    }
+}
+
+// Compile-time spaces are validated and queried during compilation. Changing a
+// probability below so that they no longer sum to one must stop the build.
+constexpr StaticProbabilitySpace<int, 6> STATIC_DIE({{1, 1.0/6.0}, {2, 1.0/6.0}, {3, 1.0/6.0},
+                                                     {4, 1.0/6.0}, {5, 1.0/6.0}, {6, 1.0/6.0}});
+constexpr double STATIC_EVEN = STATIC_DIE.probabilityOfSet({2, 4, 6});
+static_assert(STATIC_EVEN > 0.5 - 1e-9 && STATIC_EVEN < 0.5 + 1e-9, "P(even) must be 1/2 at compile time");
+static_assert(STATIC_DIE.complementOfEvent(StaticProbabilitySpace<int, 6>::all()) < 1e-9, "P(ALL^c) must be 0");
+
 int main() { 
     
     std::cout << "----------<Constructor tests>----------" << std::endl;
@@ -198,6 +333,763 @@ int main() {
     testProbability(noppa, _4_5, 2.0/3.0, SHOULD_WORK, "p({4,5}|{4,5,6,7}) should work", CONDITIONAL, many);
     noppa.setIgnoreUnknown(false);
     testProbability(noppa, _4_5, 2.0/3.0, SHOULD_FAIL, "p({4,5}|{4,5,6,7}) should fail", CONDITIONAL, many);
+
+    // Same queries through the bitset representation
+
+    testProbability(coin, heads, 0.5, SHOULD_WORK, "mask_P(heads)=0.5", MASK);
+    testProbability(coin, wrong, 0.5, SHOULD_FAIL, "mask_non-defined_event", MASK);
+    testProbability(coin, empty, 1.0, SHOULD_WORK, "mask_P({}^c)=1.0", MASK_COMPLEMENT);
+    testProbability(coin, heads, 1.0, SHOULD_WORK, "mask_P(heads U tails)=1.0", MASK_UNION, tails);
+    testProbability(coin, all, 0.0, SHOULD_WORK, "mask_P(all n {})=0.0", MASK_INTERSECTION, empty);
+    testProbability(noppa, _all, 0.0, SHOULD_WORK, "mask_P({ALL}^c)=0", MASK_COMPLEMENT);
+    testProbability(noppa, _4_5, 2.0/3.0, SHOULD_WORK, "mask_P({4,5}|{4,5,6})=2/3", MASK_CONDITIONAL, _4_5_6);
+    testProbability(noppa, _3, 0.0, SHOULD_FAIL, "mask_P({3}|{}) should fail", MASK_CONDITIONAL, _empty);
+
+    coin.setIgnoreUnknown(true);
+    testProbability(coin, wrong, 0.5, SHOULD_WORK, "mask_non-defined_event_with_mode", MASK_COMPLEMENT);
+    coin.setIgnoreUnknown(false);
+
+    std::map<int, double> wide;
+    for (int i = 0; i < 200; ++i) wide[i] = 1.0/200.0;
+    ProbabilitySpace<int> widePs(wide);
+    std::set<int> firstHundred;
+    for (int i = 0; i < 100; ++i) firstHundred.insert(i);
+    testProbability(widePs, firstHundred, 0.5, SHOULD_WORK, "mask_P([0,100))=0.5_multiword", MASK);
+    testProbability(widePs, firstHundred, 0.5, SHOULD_WORK, "mask_P([0,100)^c)=0.5_multiword", MASK_COMPLEMENT);
+
+    // Same queries through sorted iterator ranges
+
+    testProbability(coin, heads, 0.5, SHOULD_WORK, "range_P(heads)=0.5", RANGE);
+    testProbability(coin, wrong, 0.5, SHOULD_FAIL, "range_non-defined_event", RANGE);
+    testProbability(coin, heads, 0.5, SHOULD_WORK, "range_P({heads}^c)=0.5", RANGE_COMPLEMENT);
+    testProbability(coin, heads, 1.0, SHOULD_WORK, "range_P(heads U tails)=1.0", RANGE_UNION, tails);
+    testProbability(coin, all, 1.0, SHOULD_WORK, "range_P(all U heads)=1.0", RANGE_UNION, heads);
+    testProbability(coin, empty, 0.5, SHOULD_FAIL, "range_non-defined_event", RANGE_UNION, wrong);
+    testProbability(coin, tails, 0.5, SHOULD_WORK, "range_P(tails n ALL)=0.5", RANGE_INTERSECTION, all);
+    testProbability(coin, all, 0.5, SHOULD_FAIL, "range_P(all n wrong)_should_fail", RANGE_INTERSECTION, wrong);
+    testProbability(noppa, _4_5, 2.0/3.0, SHOULD_WORK, "range_P({4,5}|{4,5,6})=2/3", RANGE_CONDITIONAL, _4_5_6);
+    testProbability(noppa, _3, 0.0, SHOULD_FAIL, "range_P({3}|{}) should fail", RANGE_CONDITIONAL, _empty);
+
+    noppa.setIgnoreUnknown(true);
+    testProbability(noppa, _4_5, 2.0/3.0, SHOULD_WORK, "range_p({4,5}|{4,5,6,7}) should work", RANGE_CONDITIONAL, many);
+    testProbability(noppa, many, 0.5, SHOULD_WORK, "range_P({4,5,6,7} U {4,5})=1/2_with_mode", RANGE_UNION, _4_5);
+    noppa.setIgnoreUnknown(false);
+
+    // Same queries through validated events
+
+    testProbability(coin, heads, 0.5, SHOULD_WORK, "validated_P(heads)=0.5", VALIDATED);
+    testProbability(coin, wrong, 0.5, SHOULD_FAIL, "validated_non-defined_event", VALIDATED);
+    testProbability(coin, all, 0.0, SHOULD_WORK, "validated_P({ALL}^c)=0", VALIDATED_COMPLEMENT);
+    testProbability(coin, heads, 1.0, SHOULD_WORK, "validated_P(heads U tails)=1.0", VALIDATED_UNION, tails);
+    testProbability(coin, tails, 0.5, SHOULD_WORK, "validated_P(tails n ALL)=0.5", VALIDATED_INTERSECTION, all);
+    testProbability(noppa, _4_5, 2.0/3.0, SHOULD_WORK, "validated_P({4,5}|{4,5,6})=2/3", VALIDATED_CONDITIONAL, _4_5_6);
+    testProbability(noppa, _3, 0.0, SHOULD_FAIL, "validated_P({3}|{}) should fail", VALIDATED_CONDITIONAL, _empty);
+    testProbability(noppa, seven, 0.0, SHOULD_FAIL, "validated_P({7}|{3}) should fail", VALIDATED_CONDITIONAL, _3);
+
+    noppa.setIgnoreUnknown(true);
+    testProbability(noppa, _4_5, 2.0/3.0, SHOULD_WORK, "validated_p({4,5}|{4,5,6,7}) should work", VALIDATED_CONDITIONAL, many);
+    noppa.setIgnoreUnknown(false);
+
+    // A validated event only belongs to the space that created it
+    ProbabilitySpace<int> otherDie(die);
+    testThrows([&]{ otherDie.probabilityOfSet(noppa.validate(_1_2)); }, "foreign_validated_event");
+
+    // Batches report failures per query instead of throwing
+
+    constexpr QueryError OK = QueryError::None;
+    constexpr QueryError UNKNOWN = QueryError::UnknownOutcome;
+    constexpr QueryError ZERO = QueryError::ZeroProbabilityCondition;
+
+    testBatch(coin.probabilitiesOf({heads, wrong, all, empty}), {0.5, 0.0, 1.0, 0.0},
+              {OK, UNKNOWN, OK, OK}, "batch_probabilities");
+    testBatch(noppa.probabilitiesOf({_4_5, seven, _1_2, _4_5, seven}), {1.0/3.0, 0.0, 1.0/3.0, 1.0/3.0, 0.0},
+              {OK, UNKNOWN, OK, OK, UNKNOWN}, "batch_duplicate_events");
+    testBatch(noppa.conditionalProbabilitiesOf({_4_5, _3, seven, _all}, _4_5_6), {2.0/3.0, 0.0, 0.0, 1.0},
+              {OK, OK, UNKNOWN, OK}, "batch_shared_condition");
+    testBatch(noppa.conditionalProbabilitiesOf({_1_2, _3}, _empty), {0.0, 0.0},
+              {ZERO, ZERO}, "batch_shared_zero_condition");
+    testBatch(noppa.conditionalProbabilitiesOf({_1_2, _1_2}, many), {0.0, 0.0},
+              {UNKNOWN, UNKNOWN}, "batch_shared_unknown_condition");
+    testBatch(noppa.conditionalProbabilitiesOf({_4_5, _1_2, _3, _4_5, seven}, {_4_5_6, _all, _empty, _all, _3}),
+              {2.0/3.0, 1.0/3.0, 0.0, 1.0/3.0, 0.0}, {OK, OK, ZERO, OK, UNKNOWN}, "batch_pairwise_conditions");
+
+    noppa.setIgnoreUnknown(true);
+    testBatch(noppa.conditionalProbabilitiesOf({_4_5, seven}, many), {2.0/3.0, 0.0},
+              {OK, OK}, "batch_shared_condition_with_mode");
+    noppa.setIgnoreUnknown(false);
+
+    // The mode can be passed per batch without touching the space
+    testBatch(noppa.conditionalProbabilitiesOf({_4_5, seven}, many, true), {2.0/3.0, 0.0},
+              {OK, OK}, "batch_mode_per_call");
+    testBatch(coin.probabilitiesOf({wrong}, true), {0.5}, {OK}, "batch_probabilities_mode_per_call");
+
+    // Parallel batches must match the sequential ones
+    WorkStealingExecutor executor(4);
+    std::vector<std::set<int>> wideEvents;
+    for (int i = 0; i < 500; ++i) {
+        std::set<int> event;
+        for (int k = 0; k < i % 230; k += 1 + i % 7) event.insert(k);
+        wideEvents.push_back(event);
+    }
+    std::vector<QueryResult> parallelResults;
+    widePs.evaluateParallel(wideEvents, parallelResults, false, executor);
+    std::vector<double> sequentialTargets;
+    std::vector<QueryError> sequentialErrors;
+    for (const auto& result : widePs.probabilitiesOf(wideEvents)) {
+        sequentialTargets.push_back(result.probability);
+        sequentialErrors.push_back(result.error);
+    }
+    testBatch(parallelResults, sequentialTargets, sequentialErrors, "parallel_batch_matches_sequential");
+
+    widePs.evaluateParallel(wideEvents, firstHundred, parallelResults, true, executor);
+    sequentialTargets.clear();
+    sequentialErrors.clear();
+    for (const auto& result : widePs.conditionalProbabilitiesOf(wideEvents, firstHundred, true)) {
+        sequentialTargets.push_back(result.probability);
+        sequentialErrors.push_back(result.error);
+    }
+    testBatch(parallelResults, sequentialTargets, sequentialErrors, "parallel_conditional_batch_matches_sequential");
+
+    testThrows([&]{ noppa.conditionalProbabilitiesOf({_4_5}, std::vector<std::set<int>>{}); }, "batch_size_mismatch");
+
+    // A body may start a nested loop on its own executor, which then runs inline
+    std::vector<std::size_t> nestedCounts(8, 0);
+    executor.forEachChunk(8, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            std::vector<QueryResult> nestedResults;
+            widePs.evaluateParallel(wideEvents, nestedResults, false, executor);
+            executor.forEachChunk(100, 7, [&](std::size_t b, std::size_t e) { nestedCounts[i] += e - b; });
+        }
+    });
+    testValue(std::count(nestedCounts.begin(), nestedCounts.end(), 100), 8.0, "nested_loop_runs_inline");
+
+    // Ranges, CDF and quantiles through the prefix sums
+
+    testValue(noppa.probabilityOfRange(2, 4), 0.5, "P(2<=X<=4)=1/2");
+    testValue(noppa.probabilityOfRange(0, 10), 1.0, "P(0<=X<=10)=1");
+    testValue(noppa.probabilityOfRange(4, 2), 0.0, "P(4<=X<=2)=0");
+    testValue(noppa.probabilityOfRange(7, 9), 0.0, "P(7<=X<=9)=0");
+    testValue(coin.probabilityOfRange("a", "i"), 0.5, "P(a<=X<=i)=P(heads)");
+    testValue(noppa.cumulativeProbability(3), 0.5, "P(X<=3)=1/2");
+    testValue(noppa.cumulativeProbability(0), 0.0, "P(X<=0)=0");
+    testValue(widePs.cumulativeProbability(99), 0.5, "P(X<=99)=1/2_wide");
+    testValue(noppa.quantile(0.5), 3, "quantile(1/2)=3");
+    testValue(noppa.quantile(0.0), 1, "quantile(0)=1");
+    testValue(noppa.quantile(1.0), 6, "quantile(1)=6");
+    testThrows([&]{ noppa.quantile(1.5); }, "quantile(1.5)_should_fail");
+
+    // Samplers must reproduce the distribution and never draw impossible outcomes
+
+    std::map<int, double> loaded = {{1, 0.5}, {2, 0.0}, {3, 0.125}, {4, 0.375}};
+    ProbabilitySpace<int> loadedDie(loaded);
+    AliasSampler<int> aliasSampler(loadedDie);
+    InverseCdfSampler<int> inverseSampler(loadedDie);
+    std::mt19937_64 rng(42);
+    constexpr std::size_t DRAWS = 200000;
+    std::vector<int> draws(DRAWS);
+    aliasSampler.sample(DRAWS, rng, draws.begin());
+    std::vector<int> inverseDraws;
+    inverseSampler.sample(DRAWS, rng, std::back_inserter(inverseDraws));
+    for (int k : {1, 2, 3, 4}) {
+        double aliasFrequency = std::count(draws.begin(), draws.end(), k) / double(DRAWS);
+        double inverseFrequency = std::count(inverseDraws.begin(), inverseDraws.end(), k) / double(DRAWS);
+        testValue(std::abs(aliasFrequency - loaded[k]) < 0.01, 1.0, "alias_frequency_of_" + std::to_string(k));
+        testValue(std::abs(inverseFrequency - loaded[k]) < 0.01, 1.0, "inverse_cdf_frequency_of_" + std::to_string(k));
+    }
+    testValue(std::count(draws.begin(), draws.end(), 2), 0.0, "alias_never_draws_impossible_outcome");
+    testValue(std::count(inverseDraws.begin(), inverseDraws.end(), 2), 0.0, "inverse_cdf_never_draws_impossible_outcome");
+
+    std::vector<int> parallelDraws(DRAWS), serialDraws(DRAWS);
+    WorkStealingExecutor serialExecutor(1);
+    aliasSampler.sampleParallel(DRAWS, 7, parallelDraws.data(), executor);
+    aliasSampler.sampleParallel(DRAWS, 7, serialDraws.data(), serialExecutor);
+    testValue(parallelDraws == serialDraws, 1.0, "parallel_sampling_independent_of_thread_count");
+
+    // Mutable spaces renormalize lazily after every update
+
+    MutableProbabilitySpace<std::string> urn({{"blue", 1.0}, {"green", 3.0}});
+    testValue(urn.probabilityOf("blue"), 0.25, "mutable_P(blue)=1/4");
+    urn.updateWeight("blue", 3.0);
+    testValue(urn.probabilityOf("blue"), 0.5, "mutable_P(blue)=1/2_after_update");
+    urn.addOutcome("red", 2.0);
+    testValue(urn.probabilityOfSet({"red"}), 0.25, "mutable_P(red)=1/4_after_add");
+    testValue(urn.probabilityOfRange("a", "h"), 0.75, "mutable_P(blue<=X<=h)=3/4");
+    urn.removeOutcome("green");
+    testValue(urn.probabilityOf("red"), 0.4, "mutable_P(red)=2/5_after_remove");
+    testValue(urn.cumulativeProbability("blue"), 0.6, "mutable_P(X<=blue)=3/5");
+    testValue(urn.size(), 2, "mutable_size_after_remove");
+    urn.addOutcome("green", 5.0);
+    testValue(urn.probabilityOf("green"), 0.5, "mutable_P(green)=1/2_after_readd");
+    testValue(urn.snapshot().probabilityOfSet({"blue", "red"}), 0.5, "mutable_snapshot_P(blue,red)=1/2");
+    testThrows([&]{ urn.addOutcome("red", 1.0); }, "mutable_add_existing_should_fail");
+    testThrows([&]{ urn.updateWeight("moose", 1.0); }, "mutable_update_unknown_should_fail");
+    testThrows([&]{ urn.updateWeight("red", -1.0); }, "mutable_negative_weight_should_fail");
+    testThrows([&]{ urn.updateWeight("red", std::numeric_limits<double>::infinity()); }, "mutable_infinite_weight_should_fail");
+    testThrows([&]{ urn.addOutcome("yellow", std::numeric_limits<double>::quiet_NaN()); }, "mutable_nan_weight_should_fail");
+    testThrows([&]{ urn.probabilityOfSet({"moose"}); }, "mutable_unknown_event_should_fail");
+
+    std::map<std::string, int> urnDraws;
+    for (std::size_t k = 0; k < DRAWS; ++k) ++urnDraws[urn.sample(rng)];
+    testValue(std::abs(urnDraws["green"] / double(DRAWS) - 0.5) < 0.01, 1.0, "mutable_sample_frequency_of_green");
+    urn.updateWeight("blue", 0.0);
+    urnDraws.clear();
+    for (std::size_t k = 0; k < DRAWS; ++k) ++urnDraws[urn.sample(rng)];
+    testValue(urnDraws["blue"], 0.0, "mutable_sample_never_draws_zero_weight");
+
+    std::map<int, double> tenWeights;
+    for (int i = 1; i <= 10; ++i) tenWeights[i] = i;
+    MutableProbabilitySpace<int> shrinking(tenWeights);
+    for (int i = 1; i <= 6; ++i) shrinking.removeOutcome(i);
+    testValue(shrinking.probabilityOf(7), 7.0/34.0, "mutable_P(7)_after_compaction");
+    testValue(shrinking.probabilityOfRange(1, 8), 15.0/34.0, "mutable_range_after_compaction");
+
+    // Incremental updates don't leave rounding drift in the total
+    MutableProbabilitySpace<int> drained(std::map<int, double>{{1, 0.1}, {2, 0.2}, {3, 0.3}});
+    for (int i = 1; i <= 3; ++i) drained.updateWeight(i, 0.0);
+    testValue(drained.totalWeight() == 0.0, 1.0, "mutable_all_weights_zero_total_is_exact");
+    std::string drainedError;
+    try { drained.snapshot(); } catch (const std::invalid_argument& e) { drainedError = e.what(); }
+    testValue(drainedError == "Total weight must be positive", 1.0, "mutable_all_weights_zero_snapshot");
+    testThrows([&]{ drained.sample(rng); }, "mutable_all_weights_zero_sample");
+    drained.updateWeight(3, 2.0);
+    testValue(drained.sample(rng), 3, "mutable_sample_after_drain");
+    testValue(drained.probabilityOf(3), 1.0, "mutable_P(3)=1_after_drain");
+
+    MutableProbabilitySpace<int> churned(tenWeights);
+    std::vector<double> churnedWeights(11, 0.0);
+    for (int i = 1; i <= 10; ++i) churnedWeights[i] = i;
+    std::uniform_real_distribution<double> churnWeight(0.0, 1000.0);
+    for (int k = 0; k < 200000; ++k) {
+        int outcome = 1 + k % 10;
+        churnedWeights[outcome] = k % 3 == 0 ? churnWeight(rng) * 1e-9 : churnWeight(rng);
+        churned.updateWeight(outcome, churnedWeights[outcome]);
+    }
+    double churnedTotal = 0.0;
+    for (double w : churnedWeights) churnedTotal += w;
+    testValue(std::abs(churned.totalWeight() - churnedTotal) < 1e-12 * churnedTotal, 1.0, "mutable_long_update_sequence_total");
+    testValue(std::abs(churned.cumulativeProbability(5) * churnedTotal - (churnedWeights[1] + churnedWeights[2] + churnedWeights[3]
+              + churnedWeights[4] + churnedWeights[5])) < 1e-12 * churnedTotal, 1.0, "mutable_long_update_sequence_prefix");
+
+    // Compile-time spaces answer the same queries at run time
+
+    enum class Side { Heads, Tails };
+    constexpr StaticProbabilitySpace<Side, 2> staticCoin({{Side::Heads, 0.5}, {Side::Tails, 0.5}});
+    auto staticHeads = staticCoin.maskOf({Side::Heads});
+    testValue(staticCoin.probabilityOf(staticHeads), 0.5, "static_P(heads)=0.5");
+    testValue(staticCoin.complementOfEvent(staticHeads), 0.5, "static_P({heads}^c)=0.5");
+    testValue(STATIC_DIE.unionOfEvents(STATIC_DIE.maskOf({1, 2}), STATIC_DIE.maskOf({2, 3})), 0.5, "static_P({1,2} U {2,3})=1/2");
+    testValue(STATIC_DIE.intersectionOfEvents(STATIC_DIE.maskOf({1, 2}), STATIC_DIE.maskOf({2, 3})), 1.0/6.0, "static_P({1,2} n {2,3})=1/6");
+    testValue(STATIC_DIE.conditionalProbability(STATIC_DIE.maskOf({4, 5}), STATIC_DIE.maskOf({4, 5, 6})), 2.0/3.0, "static_P({4,5}|{4,5,6})=2/3");
+    testThrows([&]{ STATIC_DIE.conditionalProbability(STATIC_DIE.maskOf({3}), 0); }, "static_P({3}|{})_should_fail");
+    testThrows([&]{ STATIC_DIE.maskOf({7}); }, "static_non-defined_event");
+    testThrows([&]{ STATIC_DIE.probabilityOf(1u << 6); }, "static_mask_out_of_range");
+    testThrows([&]{ StaticProbabilitySpace<int, 2> invalid({{1, 0.7}, {2, 0.7}}); }, "static_invalid_distribution");
+    testThrows([&]{ StaticProbabilitySpace<int, 2> repeated({{1, 0.5}, {1, 0.5}}); }, "static_repeated_outcome");
+
+    // Construction from vectors and caller-owned arrays
+
+    ProbabilitySpace<std::string> pairCoin(std::vector<std::pair<std::string, double>>{{"tails", 0.5}, {"heads", 0.5}});
+    testProbability(pairCoin, heads, 0.5, SHOULD_WORK, "vector_pairs_P(heads)=0.5", NORMAL);
+    testThrows([&]{ ProbabilitySpace<int> repeated(std::vector<std::pair<int, double>>{{1, 0.5}, {1, 0.5}}); },
+               "vector_pairs_repeated_outcome");
+    ProbabilitySpace<int> arrayDie(SORTED_UNIQUE, std::vector<int>{1, 2, 3, 4, 5, 6}, std::vector<double>(6, 1.0/6.0));
+    testProbability(arrayDie, _4_5, 2.0/3.0, SHOULD_WORK, "sorted_arrays_P({4,5}|{4,5,6})=2/3", CONDITIONAL, _4_5_6);
+    testThrows([&]{ ProbabilitySpace<int> unsortedKeys(SORTED_UNIQUE, std::vector<int>{2, 1}, std::vector<double>{0.5, 0.5}); },
+               "sorted_arrays_unsorted_keys");
+    testThrows([&]{ ProbabilitySpace<int> mismatched(SORTED_UNIQUE, std::vector<int>{1, 2}, std::vector<double>{1.0}); },
+               "sorted_arrays_size_mismatch");
+
+    auto callerKeys = std::make_shared<std::vector<int>>(std::vector<int>{10, 20, 30, 40});
+    std::vector<double> callerProbs = {0.1, 0.2, 0.3, 0.4};
+    ProbabilitySpace<int> viewed(SORTED_UNIQUE, callerKeys->data(), callerProbs.data(), callerKeys->size(), callerKeys);
+    const int* viewedKeys = callerKeys->data();
+    callerKeys.reset();
+    testValue(&viewed.outcomeAt(0) == viewedKeys, 1.0, "view_does_not_copy_outcomes");
+    testValue(viewed.probabilityOfRange(20, 30), 0.5, "view_P(20<=X<=30)=1/2_after_owner_released");
+
+    ProbabilitySpace<int> noppaCopy = noppa;
+    testValue(noppaCopy.probabilityOfSet(noppa.validate(_1_2)), 1.0/3.0, "copies_share_validated_events");
+
+    // Binary files are queried in place after mapping them
+
+    const std::string spaceFile = "test_probability_space.pspace";
+    ProbabilitySpaceFile::save(noppa, spaceFile);
+    ProbabilitySpace<int> mappedDie = ProbabilitySpaceFile::load<int>(spaceFile, true);
+    testProbability(mappedDie, _4_5, 2.0/3.0, SHOULD_WORK, "mapped_P({4,5}|{4,5,6})=2/3", CONDITIONAL, _4_5_6);
+    testValue(mappedDie.probabilityOfRange(2, 4), 0.5, "mapped_P(2<=X<=4)=1/2");
+    testValue(mappedDie.quantile(0.5), 3.0, "mapped_quantile(0.5)=3");
+    {
+        std::fstream corrupt(spaceFile, std::ios::in | std::ios::out | std::ios::binary);
+        corrupt.seekp(-1, std::ios::end);
+        corrupt.put('\x7f');
+    }
+    testValue(ProbabilitySpaceFile::load<int>(spaceFile).size(), 6.0, "mapped_load_skips_checksum_by_default");
+    testThrows([&]{ ProbabilitySpaceFile::load<int>(spaceFile, true); }, "mapped_corrupt_checksum");
+    testThrows([&]{ ProbabilitySpaceFile::load<long long>(spaceFile); }, "mapped_wrong_outcome_type");
+    std::ofstream(spaceFile, std::ios::binary) << "not a probability space, just some text that is long enough for a header"
+                                                  " and then some more text, to get past the header size";
+    testThrows([&]{ ProbabilitySpaceFile::load<int>(spaceFile); }, "mapped_not_a_space_file");
+    std::remove(spaceFile.c_str());
+
+    // Streamed entries are merged through spill files once the budget is exceeded
+
+    ProbabilitySpaceBuilder<int> dieBuilder(64);
+    for (int face : {6, 3, 1, 5, 2, 4, 3, 1}) dieBuilder.add(face, face == 1 || face == 3 ? 1.0/12.0 : 1.0/6.0);
+    testValue(dieBuilder.spilledRuns() > 0, 1.0, "builder_spills_beyond_budget");
+    ProbabilitySpace<int> builtDie = dieBuilder.build();
+    testValue(builtDie.size(), 6.0, "builder_merges_repeated_outcomes");
+    testProbability(builtDie, _1_2, 1.0/3.0, SHOULD_WORK, "builder_P({1,2})=1/3", NORMAL);
+    testValue(dieBuilder.entries(), 0.0, "builder_is_reset_by_build");
+
+    WorkStealingExecutor csvExecutor(3);
+    std::istringstream coinCsv("heads, 0.25\r\ntails,0.5\n\nheads,0.25");
+    ProbabilitySpaceBuilder<std::string> coinBuilder(1);
+    coinBuilder.addCsv(coinCsv, csvExecutor);
+    testProbability(coinBuilder.build(), heads, 0.5, SHOULD_WORK, "builder_csv_P(heads)=0.5", NORMAL);
+    std::istringstream dieCsv("1,0.5\n2,0.25\n3,0.125\n");
+    ProbabilitySpaceBuilder<int> csvBuilder;
+    csvBuilder.addCsv(dieCsv, csvExecutor);
+    testThrows([&]{ csvBuilder.build(); }, "builder_csv_invalid_distribution");
+    std::istringstream malformedCsv("1,0.5\n2;0.5\n");
+    testThrows([&]{ csvBuilder.addCsv(malformedCsv, csvExecutor); }, "builder_csv_malformed_line");
+    testThrows([&]{ csvBuilder.add(4, -0.5); }, "builder_negative_probability");
+
+    // Product spaces answer rectangles from the marginals
+
+    ProductSpace<int, std::string> dieAndCoin(noppa, coin);
+    testValue(dieAndCoin.size(), 12.0, "product_size");
+    testValue(dieAndCoin.probabilityOf({3, "heads"}), 1.0/12.0, "product_P((3,heads))=1/12");
+    testValue(dieAndCoin.probabilityOfRectangle(_1_2, heads), 1.0/6.0, "product_P({1,2}x{heads})=1/6");
+    testValue(dieAndCoin.probabilityOfRectangle(noppa.validate(_4_5_6), coin.validate(heads)), 0.25,
+              "product_validated_P({4,5,6}x{heads})=1/4");
+    testValue(dieAndCoin.complementOfRectangle(_1_2, heads), 5.0/6.0, "product_P(({1,2}x{heads})^c)=5/6");
+    testValue(dieAndCoin.conditionalProbability({_4_5, heads}, {_4_5_6, heads}), 2.0/3.0,
+              "product_P({4,5}x{heads}|{4,5,6}x{heads})=2/3");
+    testThrows([&]{ dieAndCoin.conditionalProbability({_1_2, heads}, {_1_2, {}}); }, "product_P(A|B)_with_P(B)=0");
+    testThrows([&]{ dieAndCoin.probabilityOf({7, "heads"}); }, "product_non-defined_outcome");
+    testValue(std::get<0>(dieAndCoin.outcomeAt(5)) == 3 && std::get<1>(dieAndCoin.outcomeAt(5)) == "tails", 1.0,
+              "product_outcomeAt(5)=(3,tails)");
+    ProbabilitySpace<std::tuple<int, std::string>> jointTable = dieAndCoin.materialize();
+    testValue(jointTable.size(), 12.0, "product_materialize_size");
+    testValue(jointTable.cumulativeProbability({2, "tails"}), 1.0/3.0, "product_materialize_P(X<=(2,tails))=1/3");
+
+    // Random variables are dot products with the probabilities of the space
+
+    RandomVariable<int> face(noppa, [](int x){ return double(x); });
+    testValue(face.expectation(), 3.5, "E[X]=3.5");
+    testValue(face.variance(), 35.0/12.0, "Var[X]=35/12");
+    testValue(face.moment(2), 91.0/6.0, "E[X^2]=91/6");
+    testValue(face.centralMoment(3), 0.0, "E[(X-E[X])^3]=0");
+    testValue(face.conditionalExpectation(_4_5_6), 5.0, "E[X|{4,5,6}]=5");
+    testValue(face.conditionalExpectation(noppa.validate(_1_2)), 1.5, "E[X|{1,2}]=1.5");
+    testThrows([&]{ face.conditionalExpectation(std::set<int>{}); }, "E[X|{}]_should_fail");
+    testThrows([&]{ face.conditionalExpectation(std::set<int>{7}); }, "E[X|{7}]_non-defined_event");
+    testThrows([&]{ RandomVariable<int> short_(noppa, std::vector<double>{1.0}); }, "random_variable_size_mismatch");
+    RandomVariable<int> even(noppa, [](int x){ return x % 2 == 0 ? 1.0 : 0.0; });
+    std::vector<double> fused = expectations(std::vector<RandomVariable<int>>{face, even});
+    testValue(fused[0], 3.5, "fused_E[X]=3.5");
+    testValue(fused[1], 0.5, "fused_E[1_even]=1/2");
+    testThrows([&]{ expectations(std::vector<RandomVariable<int>>{face, RandomVariable<int>(arrayDie, even.valueData())}); },
+               "fused_different_spaces_should_fail");
+    std::map<int, double> unevenWeights;
+    double unevenTotal = 0.0;
+    for (int i = 0; i < 2503; ++i) unevenTotal += i % 7 + 1;
+    for (int i = 0; i < 2503; ++i) unevenWeights[i] = (i % 7 + 1) / unevenTotal;
+    ProbabilitySpace<int> uneven(unevenWeights);
+    std::vector<RandomVariable<int>> unevenVariables = {RandomVariable<int>(uneven, [](int x){ return std::sin(x); }),
+                                                        RandomVariable<int>(uneven, [](int x){ return 1e6 + 0.1 * x * x; })};
+    std::vector<double> unevenMeans = expectations(unevenVariables);
+    std::vector<double> unevenVariances = variances(unevenVariables);
+    testValue(unevenMeans[0] == unevenVariables[0].expectation() && unevenMeans[1] == unevenVariables[1].expectation(),
+              1.0, "fused_expectations_bit_identical");
+    testValue(unevenVariances[0] == unevenVariables[0].variance() && unevenVariances[1] == unevenVariables[1].variance(),
+              1.0, "fused_variances_bit_identical");
+
+    // Cached queries hit on repeats and miss after the space changes
+
+    QueryCache<int> dieCache(noppa, 4);
+    testValue(dieCache.conditionalProbability(_4_5, _4_5_6), 2.0/3.0, "cache_P({4,5}|{4,5,6})=2/3_miss");
+    testValue(dieCache.conditionalProbability(_4_5, _4_5_6), 2.0/3.0, "cache_P({4,5}|{4,5,6})=2/3_hit");
+    testValue(dieCache.probabilityOfSet(_4_5), 1.0/3.0, "cache_P({4,5})=1/3_not_confused_with_conditional");
+    testValue(dieCache.stats().hits, 1.0, "cache_counts_hits");
+    testValue(dieCache.stats().misses, 2.0, "cache_counts_misses");
+    testThrows([&]{ dieCache.probabilityOfSet(std::set<int>{7}); }, "cache_non-defined_event");
+    for (int k = 1; k <= 6; ++k) {
+        for (int j = k; j <= 6; ++j) dieCache.probabilityOfSet(std::set<int>{k, j});
+    }
+    testValue(dieCache.stats().evictions > 0, 1.0, "cache_evicts_beyond_capacity");
+    testValue(dieCache.probabilityOfSet(std::set<int>{1, 6}), 1.0/3.0, "cache_P({1,6})=1/3_after_evictions");
+
+    MutableProbabilitySpace<std::string> cachedUrn(std::map<std::string, double>{{"blue", 1.0}, {"green", 1.0}});
+    QueryCache<std::string, MutableProbabilitySpace<std::string>> urnCache(cachedUrn);
+    testValue(urnCache.probabilityOfSet({"blue"}), 0.5, "cache_mutable_P(blue)=1/2");
+    cachedUrn.updateWeight("blue", 3.0);
+    testValue(urnCache.probabilityOfSet({"blue"}), 0.75, "cache_invalidated_by_update");
+    testValue(urnCache.stats().hits, 0.0, "cache_stale_result_is_a_miss");
+    cachedUrn.addOutcome("red", 4.0);
+    testValue(urnCache.conditionalProbability({"blue"}, {"blue", "green"}), 0.75, "cache_mutable_P(blue|blue,green)=3/4");
+    urnCache.conditionalProbability({"blue"}, {"blue", "green"});
+    testValue(urnCache.stats().hits, 1.0, "cache_mutable_conditional_hit");
+    testValue(cachedUrn.conditionalProbability({"blue", "red"}, {"green", "red"}), 0.8, "mutable_P(blue,red|green,red)=4/5");
+    testThrows([&]{ cachedUrn.conditionalProbability({"moose"}, {"red"}); }, "mutable_conditional_unknown_event");
+    cachedUrn.updateWeight("red", 0.0);
+    testThrows([&]{ urnCache.conditionalProbability({"blue"}, {"red"}); }, "mutable_conditional_zero_condition");
+
+    // Conditioned views answer P(A|B) without recomputing P(B)
+
+    ConditionedSpace<int> high = noppa.conditionOn(_4_5_6);
+    testValue(high.conditionProbability(), 0.5, "view_P({4,5,6})=1/2");
+    testValue(high.probabilityOfSet(_4_5), 2.0/3.0, "view_P({4,5}|{4,5,6})=2/3");
+    std::vector<int> vec_4_5(_4_5.begin(), _4_5.end());
+    testValue(high.probabilityOfSet(vec_4_5.begin(), vec_4_5.end()), 2.0/3.0, "view_range_P({4,5}|{4,5,6})=2/3");
+    testValue(high.probabilityOfSet(noppa.validate(_1_2)), 0.0, "view_validated_P({1,2}|{4,5,6})=0");
+    testValue(high.probabilityOfMask(noppa.maskOf(_4_5)), 2.0/3.0, "view_mask_P({4,5}|{4,5,6})=2/3");
+    testValue(high.complementOfEvent(_4_5), 1.0/3.0, "view_P({4,5}^c|{4,5,6})=1/3");
+    testValue(high.conditionOn(_4_5).probabilityOfSet(std::set<int>{5}), 0.5, "view_composed_P({5}|{4,5})=1/2");
+    testValue(high.conditionOn(noppa.validate(_4_5)).size(), 2.0, "view_composed_with_validated_event");
+    testThrows([&]{ high.conditionOn(_1_2); }, "view_P(.|{})_should_fail");
+    testThrows([&]{ noppa.conditionOn(std::set<int>{7}); }, "view_non-defined_condition");
+    testThrows([&]{ high.probabilityOfSet(std::set<int>{7}); }, "view_non-defined_event");
+    testThrows([&]{ high.probabilityOfSet(arrayDie.validate(_4_5)); }, "view_foreign_validated_event");
+
+    // Instrumented queries are counted per thread and merged on snapshot
+    // Counting is best-effort, so the hooks can't break the noexcept try* queries
+    static_assert(noexcept(QueryTimer(QueryOperation::Probability, {1})), "query timers must not throw");
+    static_assert(noexcept(threadCounters().addFailure()), "counters must not throw");
+    static_assert(noexcept(noppa.tryProbabilityOfSet(_1_2)), "try queries stay noexcept");
+
+    resetInstrumentation();
+    noppa.probabilityOfSet(_1_2);
+    noppa.conditionalProbability(_4_5, _4_5_6);
+    noppa.unionOfEvents(noppa.validate(_1_2), noppa.validate(_4_5));
+    try { noppa.probabilityOfSet(std::set<int>{7}); } catch (const std::invalid_argument&) {}
+    std::thread([&]{ noppa.probabilityOfSet(_4_5_6); }).join();
+    InstrumentationSnapshot stats = instrumentationSnapshot();
+    testValue(stats.calls[static_cast<std::size_t>(QueryOperation::Probability)], 3.0, "instrumentation_counts_queries_of_all_threads");
+    testValue(stats.calls[static_cast<std::size_t>(QueryOperation::Conditional)], 1.0, "instrumentation_counts_conditionals");
+    testValue(stats.validationFailures, 1.0, "instrumentation_counts_validation_failures");
+    testValue(stats.eventSizeSum, 2.0 + 2.0 + 3.0 + 2.0 + 2.0 + 1.0 + 3.0, "instrumentation_sums_event_sizes");
+    testValue(stats.bytesAllocated >= 4 * sizeof(std::size_t), 1.0, "instrumentation_counts_allocated_bytes");
+    std::string exposition = prometheusText(stats);
+    testValue(exposition.find("probability_engine_query_latency_seconds_count{operation=\"union\"} 1\n") != std::string::npos,
+              1.0, "instrumentation_prometheus_text");
+    std::uint64_t published = 0;
+    publishInstrumentation([&](const InstrumentationSnapshot& snapshot){ published = snapshot.calls[0]; });
+    testValue(published, 3.0, "instrumentation_publishes_to_sink");
+
+    // The try* queries report failures in their result instead of throwing
+
+    static_assert(noexcept(noppa.tryConditionalProbability(_4_5, _4_5_6)), "try* queries must not throw");
+    testValue(noppa.tryConditionalProbability(_4_5, _4_5_6).value().value_or(-1.0), 2.0/3.0, "try_P({4,5}|{4,5,6})=2/3");
+    testValue(noppa.tryUnionOfEvents(_1_2, _4_5).probability, 2.0/3.0, "try_P({1,2} U {4,5})=2/3");
+    testValue(noppa.tryProbabilityOfSet(std::set<int>{7}).error == QueryError::UnknownOutcome, 1.0, "try_non-defined_event");
+    testValue(noppa.tryProbabilityOfSet(std::set<int>{7}).value().has_value(), 0.0, "try_failure_has_no_value");
+    testValue(noppa.tryConditionalProbability(_1_2, std::set<int>{}).error == QueryError::ZeroProbabilityCondition, 1.0,
+              "try_P(A|{})_zero_probability_condition");
+    std::vector<int> tryUnsorted = {2, 1};
+    testValue(noppa.tryComplementOfEvent(tryUnsorted.begin(), tryUnsorted.end()).error == QueryError::UnsortedEvent, 1.0,
+              "try_unsorted_range");
+    testValue(noppa.tryIntersectionOfEvents(arrayDie.validate(_1_2), noppa.validate(_1_2)).error == QueryError::ForeignEvent,
+              1.0, "try_foreign_validated_event");
+    testThrows([&]{ noppa.complementOfEvent(arrayDie.validate(_1_2)); }, "foreign_validated_event_still_throws");
+
+    std::vector<int> unsorted = {2, 1};
+    testThrows([&]{ noppa.probabilityOfSet(unsorted.begin(), unsorted.end()); }, "unsorted_range");
+
+    // Dense integral outcomes are indexed directly, sparse ones are searched
+
+    testValue(noppa.isDirectlyIndexed(), 1.0, "direct_index_contiguous_die");
+    ProbabilitySpace<int> gapped(std::map<int, double>{{-3, 0.25}, {-1, 0.25}, {0, 0.25}, {2, 0.25}});
+    testValue(gapped.isDirectlyIndexed(), 1.0, "direct_index_with_gaps");
+    testValue(gapped.probabilityOfSet(std::set<int>{-3, 0, 2}), 0.75, "direct_index_P({-3,0,2})=3/4");
+    testValue(gapped.tryProbabilityOfSet(std::set<int>{-2}).error == QueryError::UnknownOutcome, 1.0, "direct_index_gap_is_unknown");
+    testValue(gapped.tryProbabilityOfSet(std::set<int>{-4, 3}).error == QueryError::UnknownOutcome, 1.0, "direct_index_out_of_range");
+    testValue(gapped.probabilityOfRange(-2, 1), 0.5, "direct_index_P([-2,1])=1/2");
+    ProbabilitySpace<int> sparse(std::map<int, double>{{-1000000, 0.5}, {1000000, 0.5}});
+    testValue(sparse.isDirectlyIndexed(), 0.0, "sparse_outcomes_are_searched");
+    testValue(sparse.probabilityOfSet(std::set<int>{1000000}), 0.5, "sparse_P({1000000})=1/2");
+    ProbabilitySpace<long long> extremes(std::map<long long, double>{{std::numeric_limits<long long>::min(), 0.5},
+                                                                     {std::numeric_limits<long long>::max(), 0.5}});
+    testValue(extremes.probabilityOfSet(std::set<long long>{std::numeric_limits<long long>::max()}), 0.5,
+              "sparse_extreme_keys_do_not_overflow");
+    ProbabilitySpace<unsigned char> bytes(std::map<unsigned char, double>{{254, 0.5}, {255, 0.5}});
+    testValue(bytes.probabilityOfSet(std::set<unsigned char>{255}), 0.5, "direct_index_unsigned_edge");
+
+    // Symbol tables map labels to outcome IDs, events built from them skip all comparisons
+
+    SymbolTable<std::string> coinSymbols(coin);
+    std::string_view headsLabel = "heads";
+    testValue(coinSymbols.find(headsLabel) != NO_OUTCOME, 1.0, "symbol_table_finds_string_view");
+    testValue(coinSymbols.find("moose") == NO_OUTCOME, 1.0, "symbol_table_unknown_label");
+    testValue(coinSymbols.outcome(coinSymbols.id("tails")) == "tails", 1.0, "symbol_table_id_round_trip");
+    testValue(coin.probabilityOfSet(coinSymbols.eventOf({"tails", "heads", "tails"})), 1.0, "symbol_table_P({heads,tails})=1");
+    testValue(coin.complementOfEvent(coinSymbols.eventOf({coinSymbols.id("heads")})), 0.5, "symbol_table_event_of_ids");
+    testThrows([&]{ coinSymbols.eventOf({"heads", "moose"}); }, "symbol_table_unknown_label_in_event");
+    testThrows([&]{ coinSymbols.eventOf(std::vector<OutcomeId>{7}); }, "symbol_table_unknown_id");
+    testThrows([&]{ coinSymbols.id("moose"); }, "symbol_table_unknown_id_of_label");
+    SymbolTable<int> dieSymbols(noppa);
+    std::vector<int> highLabels = {6, 4, 5};
+    testValue(noppa.conditionalProbability(dieSymbols.eventOf(_4_5.begin(), _4_5.end()),
+                                           dieSymbols.eventOf(highLabels.begin(), highLabels.end())), 2.0/3.0,
+              "symbol_table_P({4,5}|{4,5,6})=2/3");
+
+    // Bayesian updates reuse the outcomes of the prior
+
+    ProbabilitySpace<int> evenRoll = noppa.bayesUpdate(std::vector<double>{0, 1, 0, 1, 0, 1});
+    testValue(evenRoll.probabilityOfSet(std::set<int>{2}), 1.0/3.0, "bayes_P({2}|even)=1/3");
+    testValue(&evenRoll.outcomeAt(0) == &noppa.outcomeAt(0), 1.0, "bayes_posterior_shares_outcomes");
+    testValue(noppa.bayesUpdate([](int k){ return k > 4 ? 3.0 : 1.0; }).probabilityOfSet(std::set<int>{6}), 0.3,
+              "bayes_callable_likelihood");
+    testThrows([&]{ noppa.bayesUpdate(std::vector<double>{1, 1}); }, "bayes_wrong_number_of_likelihoods");
+    testThrows([&]{ noppa.bayesUpdate(std::vector<double>(6, 0.0)); }, "bayes_impossible_observation");
+    testThrows([&]{ noppa.bayesUpdate(std::vector<double>{1, 1, 1, 1, 1, -1}); }, "bayes_negative_likelihood");
+    testThrows([&]{ evenRoll.bayesUpdate(std::vector<double>{1, 0, 1, 0, 1, 0}); }, "bayes_contradicting_observations");
+
+    BayesianUpdater<int> stream(noppa);
+    std::vector<double> favoursSix = {1e-3, 1e-3, 1e-3, 1e-3, 2e-3, 1e-2};
+    for (int i = 0; i < 2000; ++i) stream.observe(favoursSix);
+    testValue(stream.observations(), 2000.0, "bayes_stream_counts_observations");
+    testValue(stream.posterior().probabilityOfSet(std::set<int>{6}), 1.0, "bayes_stream_does_not_underflow");
+    testValue(std::abs(stream.logEvidence() - (std::log(1.0/6.0) + 2000 * std::log(1e-2))) < 1e-6, 1.0,
+              "bayes_stream_log_evidence");
+    stream.reset();
+    stream.observeLog({-1e6, -1e6, -std::numeric_limits<double>::infinity(), 0, 0, 0});
+    testValue(stream.posterior().probabilityOfSet(_4_5), 2.0/3.0, "bayes_stream_log_likelihoods");
+    testThrows([&]{ stream.observeLog(std::vector<double>(6, -std::numeric_limits<double>::infinity())); stream.posterior(); },
+               "bayes_stream_impossible_observations");
+    BayesianUpdater<int> ruledOut(ProbabilitySpace<int>(std::map<int, double>{{0, 0.0}, {1, 0.5}, {2, 0.5}}));
+    ruledOut.observeLog({0, -400, -400});
+    ruledOut.observeLog({0, -400, -400});
+    testValue(ruledOut.posterior().probabilityOfSet({1}), 0.5, "bayes_stream_ignores_zero_prior_outcomes");
+    testValue(ruledOut.logEvidence(), -800.0, "bayes_stream_log_evidence_with_zero_prior");
+
+    MutableProbabilitySpace<int> weights(std::map<int, double>{{1, 1.0}, {2, 1.0}, {3, 2.0}});
+    std::uint64_t versionBefore = weights.version();
+    weights.bayesUpdate([](int k){ return k == 1 ? 2.0 : 1.0; });
+    testValue(weights.probabilityOf(1), 0.4, "bayes_in_place_P({1})=2/5");
+    testValue(weights.version() != versionBefore, 1.0, "bayes_in_place_bumps_version");
+
+    // Log-space spaces keep probabilities far below the range of a double
+
+    std::map<int, double> tinyLogs;
+    for (int k = 0; k < 1000; ++k) tinyLogs[k] = -1000.0 - k;
+    tinyLogs[1000] = std::log1p(-1e-300);
+    LogProbabilitySpace<int> tiny(tinyLogs);
+    testValue(tiny.logProbabilityOfSet(std::set<int>{0}), -1000.0, "log_space_keeps_exp(-1000)");
+    testValue(std::abs(tiny.logProbabilityOfSet(std::set<int>{0, 1}) - (-1000.0 + std::log1p(std::exp(-1.0)))) < 1e-12, 1.0,
+              "log_space_log_sum_exp");
+    testValue(std::abs(tiny.logComplementOfEvent(std::set<int>{1000}) - (-1000.0 - std::log1p(-std::exp(-1.0)))) < 1e-12,
+              1.0, "log_space_complement_of_almost_sure_event");
+    testValue(std::abs(tiny.logConditionalProbability(std::set<int>{1}, std::set<int>{0, 1}) + std::log1p(std::exp(1.0))) < 1e-12,
+              1.0, "log_space_conditional");
+    testValue(tiny.logProbabilityOfRange(0, 999) == tiny.logComplementOfEvent(std::set<int>{1000}), 1.0,
+              "log_space_range_matches_complement");
+    testValue(tiny.logIntersectionOfEvents(std::set<int>{0}, std::set<int>{1}) == -std::numeric_limits<double>::infinity(), 1.0,
+              "log_space_empty_intersection");
+    testValue(std::abs(tiny.logUnionOfEvents(std::set<int>{0}, std::set<int>{0, 1}) - tiny.logProbabilityOfSet(std::set<int>{0, 1})) < 1e-12,
+              1.0, "log_space_union");
+    LogProbabilitySpace<int> conditioned = tiny.conditionOn(std::set<int>{0, 1}).conditionOn(std::set<int>{1});
+    testValue(conditioned.logProbabilityOfSet(std::set<int>{1}), 0.0, "log_space_repeated_conditioning");
+    testThrows([&]{ tiny.logProbabilityOfSet(std::set<int>{-1}); }, "log_space_non-defined_event");
+    testThrows([&]{ LogProbabilitySpace<int>(std::map<int, double>{{1, std::log(0.5)}, {2, std::log(0.4)}}); },
+               "log_space_must_sum_to_one");
+    testThrows([&]{ LogProbabilitySpace<int>(std::map<int, double>{{1, 0.1}}); }, "log_space_positive_log");
+    testValue(LogProbabilitySpace<int>(noppa).probabilityOfSet(_4_5), 1.0/3.0, "log_space_from_space_P({4,5})=1/3");
+    testValue(sumTolerance(100000000) > EPSILON, 1.0, "sum_tolerance_scales_with_n");
+    std::vector<int> toleranceKeys(1000000);
+    for (int i = 0; i < 1000000; ++i) toleranceKeys[i] = i;
+    ProbabilitySpace<int> nearlyOne(SORTED_UNIQUE, toleranceKeys, std::vector<double>(1000000, (1.0 + 1.1e-9) / 1e6));
+    testValue(nearlyOne.size(), 1000000.0, "linear_space_accepts_total_within_sum_tolerance");
+    testThrows([&]{ ProbabilitySpace<int>(SORTED_UNIQUE, toleranceKeys, std::vector<double>(1000000, (1.0 + 1.5e-9) / 1e6)); },
+               "linear_space_rejects_total_beyond_sum_tolerance");
+
+    // Summation policies sum in blocks, so parallel sums are bit-identical for any thread count
+
+    std::vector<int> millionKeys(1000000);
+    std::vector<double> millionProbs(millionKeys.size(), 1e-6);
+    for (std::size_t i = 0; i < millionKeys.size(); ++i) millionKeys[i] = static_cast<int>(i);
+    ProbabilitySpace<int> naiveMillion(SORTED_UNIQUE, millionKeys, millionProbs);
+    ProbabilitySpace<int, NeumaierSum> neumaierMillion(naiveMillion);
+    ProbabilitySpace<int, PairwiseSum> pairwiseMillion(naiveMillion);
+    ValidatedEvent<int> million = naiveMillion.validate(millionKeys.begin(), millionKeys.end());
+    double naiveError = std::abs(naiveMillion.probabilityOfSet(million) - 1.0);
+    testValue(std::abs(neumaierMillion.probabilityOfSet(million) - 1.0) <= naiveError, 1.0, "neumaier_sum_is_more_accurate");
+    testValue(std::abs(pairwiseMillion.probabilityOfSet(million) - 1.0) <= naiveError, 1.0, "pairwise_sum_is_more_accurate");
+    testValue(pairwiseMillion.probabilityOfSet(_4_5), 2e-6, "pairwise_space_shares_outcomes");
+    bool reproducible = true;
+    for (unsigned threads : {1u, 2u, 3u, 8u}) {
+        WorkStealingExecutor sumExecutor(threads);
+        reproducible &= naiveMillion.probabilityOfSet(million, sumExecutor) == naiveMillion.probabilityOfSet(million);
+        reproducible &= neumaierMillion.probabilityOfSet(million, sumExecutor) == neumaierMillion.probabilityOfSet(million);
+        reproducible &= pairwiseMillion.probabilityOfSet(million, sumExecutor) == pairwiseMillion.probabilityOfSet(million);
+    }
+    testValue(reproducible, 1.0, "parallel_sums_are_bit_identical");
+    ProbabilitySpace<int, PairwiseSum> pairwiseDie(noppa);
+    testValue(pairwiseDie.conditionOn(_4_5_6).probabilityOfSet(_4_5), 2.0/3.0, "pairwise_condition_view");
+    std::map<int, double> evenKeys;
+    for (int i = 0; i < 1000; ++i) evenKeys[2 * i] = 1e-3;
+    ProbabilitySpace<int> tableIndexed(evenKeys);
+    std::uint64_t bytesBeforeView = instrumentationSnapshot().bytesAllocated;
+    ProbabilitySpace<int, NeumaierSum> neumaierTable(tableIndexed);
+    testValue(instrumentationSnapshot().bytesAllocated == bytesBeforeView, 1.0, "policy_view_shares_key_index");
+    testValue(neumaierTable.isDirectlyIndexed() && neumaierTable.probabilityOfRange(3, 7) == 2e-3, 1.0,
+              "policy_view_uses_shared_key_index");
+    testThrows([&]{ naiveMillion.probabilityOfSet(noppa.validate(_4_5), serialExecutor); }, "parallel_sum_foreign_event");
+
+    // Lazy event expressions are evaluated in one pass without intermediate masks
+
+    EventMask lowMask = noppa.maskOf(_1_2);
+    EventMask highMask = noppa.maskOf(_4_5_6);
+    EventMask evenMask = noppa.maskOf(std::set<int>{2, 4, 6});
+    testValue(noppa.probabilityOfSet(lazy(lowMask) | highMask), 5.0/6.0, "expression_P({1,2} U {4,5,6})=5/6");
+    testValue(noppa.probabilityOfSet(lazy(lowMask) | (lazy(highMask) & ~lazy(evenMask))), 0.5,
+              "expression_P({1,2} U ({4,5,6} n {2,4,6}^c))=1/2");
+    testValue(noppa.probabilityOfSet(~noppa.rangeEvent(2, 5)), 2.0/6.0, "expression_range_complement");
+    testValue(noppa.probabilityOfSet(noppa.rangeEvent(3, 1)), 0.0, "expression_empty_range");
+    testValue(noppa.conditionalProbability((lazy(lowMask) | highMask) & ~lazy(evenMask), noppa.rangeEvent(1, 5)), 2.0/5.0,
+              "expression_P(((A U B) n C^c) | D)=2/5");
+    testValue(noppa.probabilityOfSet(lazy(lowMask) | highMask) == noppa.probabilityOfMask(lowMask | highMask), 1.0,
+              "expression_sum_matches_mask_sum");
+    testValue(noppa.maskOf(lazy(highMask) & evenMask) == (highMask & evenMask), 1.0, "expression_materializes_to_mask");
+    testThrows([&]{ noppa.conditionalProbability(lazy(lowMask), noppa.rangeEvent(7, 9)); }, "expression_P(.|{})_should_fail");
+    testThrows([&]{ noppa.probabilityOfSet(lazy(lowMask) | EventMask(3)); }, "expression_masks_of_different_spaces");
+    std::vector<int> wideKeys(200);
+    for (int k = 0; k < 200; ++k) wideKeys[k] = k;
+    ProbabilitySpace<int> wideSpace(SORTED_UNIQUE, wideKeys, std::vector<double>(200, 1.0 / 200));
+    testValue(wideSpace.probabilityOfSet(~wideSpace.rangeEvent(10, 150)), 59.0 / 200, "expression_range_across_words");
+
+    // Distribution factories build their tables directly and answer ranges in closed form
+
+    DiscreteDistribution uniformDie = uniformDistribution(1, 6);
+    testValue(uniformDie.probabilityOfRange(2, 4), 0.5, "uniform_P([2,4])=1/2");
+    testValue(uniformDie.probabilitySpace().probabilityOfSet(_4_5), 1.0/3.0, "uniform_table_P({4,5})=1/3");
+    testValue(uniformDie.cumulativeProbability(0), 0.0, "uniform_cdf_below_support");
+    DiscreteDistribution coins = binomialDistribution(10, 0.5);
+    testValue(coins.cumulativeProbability(5), 638.0/1024.0, "binomial_P(X<=5)=638/1024");
+    testValue(coins.probabilitySpace().probabilityOfSet(std::set<int>{0}), 1.0/1024.0, "binomial_table_P(X=0)=1/1024");
+    DiscreteDistribution skewed = binomialDistribution(1000, 0.3);
+    testValue(std::abs(skewed.probabilityOfRange(250, 320) - skewed.probabilitySpace().probabilityOfRange(250, 320)) < 1e-10,
+              1.0, "binomial_closed_form_matches_table");
+    testValue(std::abs(skewed.cumulativeProbability(400) - skewed.probabilitySpace().cumulativeProbability(400)) < 1e-10,
+              1.0, "binomial_upper_tail_matches_table");
+    DiscreteDistribution wideBinomial = binomialDistribution(1000000, 0.5, 1e-12);
+    testValue(wideBinomial.probabilitySpace().size() < 20000, 1.0, "binomial_tolerance_bounds_table");
+    testValue(std::abs(wideBinomial.cumulativeProbability(499999) - 0.5 + wideBinomial.probabilityOfRange(500000, 500000) / 2) < 1e-6,
+              1.0, "binomial_closed_form_cdf_at_mean");
+    DiscreteDistribution arrivals = poissonDistribution(4.0);
+    testValue(std::abs(arrivals.probabilityOfRange(0, 0) - std::exp(-4.0)) < 1e-12, 1.0, "poisson_P(X=0)=e^-4");
+    testValue(arrivals.probabilitySpace().size() < 60, 1.0, "poisson_tolerance_bounds_table");
+    DiscreteDistribution firstHeads = geometricDistribution(0.5);
+    testValue(firstHeads.probabilityOfRange(2, 3), 0.375, "geometric_P([2,3])=3/8");
+    testValue(std::abs(firstHeads.probabilityOfRange(2, 3) - firstHeads.probabilitySpace().probabilityOfRange(2, 3)) < 1e-12,
+              1.0, "geometric_closed_form_matches_table");
+    testValue(firstHeads.probabilitySpace().size() < 50, 1.0, "geometric_tolerance_bounds_table");
+    testThrows([&]{ uniformDistribution(3, 1); }, "uniform_empty_support");
+    testThrows([&]{ binomialDistribution(10, 1.5); }, "binomial_invalid_probability");
+    testThrows([&]{ poissonDistribution(4.0, 0.0); }, "poisson_needs_truncation");
+    testThrows([&]{ geometricDistribution(0.0); }, "geometric_invalid_probability");
+    testThrows([&]{ geometricDistribution(1e-12); }, "geometric_table_too_long");
+    testThrows([&]{ binomialDistribution(std::numeric_limits<int>::max(), 0.5); }, "binomial_table_too_long");
+    testValue(poissonDistribution(1e9).probabilitySpace().size() < 1000000, 1.0, "poisson_largest_mean_table_is_bounded");
+
+    // Markov chains propagate distributions through the CSR matrix of their rows
+
+    std::map<int, ProbabilitySpace<int>> weather = {
+        {0, ProbabilitySpace<int>(std::map<int, double>{{0, 0.9}, {1, 0.1}})},
+        {1, ProbabilitySpace<int>(std::map<int, double>{{0, 0.5}, {1, 0.5}})}};
+    MarkovChain<int> weatherChain(weather);
+    ProbabilitySpace<int> sunny(std::map<int, double>{{0, 1.0}});
+    testValue(weatherChain.transitions(), 4.0, "markov_csr_transitions");
+    testValue(weatherChain.propagate(sunny, 2).probabilityOfSet({0}), 0.86, "markov_two_steps_P(sunny)=0.86");
+    testValue(weatherChain.power(2).row(0).probabilityOfSet({0}), 0.86, "markov_squared_P(sunny)=0.86");
+    testValue(weatherChain.power(5).row(1).probabilityOfSet({1}), weatherChain.propagate(weatherChain.row(1), 4).probabilityOfSet({1}),
+              "markov_power_matches_propagation");
+    testValue(weatherChain.stationaryDistribution().probabilityOfSet({0}), 5.0/6.0, "markov_stationary_P(sunny)=5/6");
+    std::map<int, ProbabilitySpace<int>> ring;
+    for (int s = 0; s < 1000; ++s)
+        ring.emplace(s, ProbabilitySpace<int>(std::map<int, double>{{(s + 1) % 1000, 0.75}, {(s + 999) % 1000, 0.25}}));
+    MarkovChain<int> ringChain(ring);
+    ProbabilitySpace<int> ringStart(std::map<int, double>{{0, 1.0}});
+    WorkStealingExecutor markovExecutor(4);
+    ProbabilitySpace<int> ringSerial = ringChain.propagate(ringStart, 50);
+    ProbabilitySpace<int> ringParallel = ringChain.propagate(ringStart, 50, markovExecutor);
+    bool ringIdentical = ringSerial.size() == 1000 && ringParallel.size() == 1000;
+    for (std::size_t i = 0; ringIdentical && i < 1000; ++i) ringIdentical = ringSerial.probabilityAt(i) == ringParallel.probabilityAt(i);
+    testValue(ringIdentical, 1.0, "markov_parallel_propagation_is_reproducible");
+    testValue(ringChain.power(50, markovExecutor).row(0).probabilityOfSet({50}), ringSerial.probabilityOfSet({50}), "markov_parallel_power");
+    std::map<int, ProbabilitySpace<int>> flipFlop = {
+        {0, ProbabilitySpace<int>(std::map<int, double>{{1, 1.0}})},
+        {1, ProbabilitySpace<int>(std::map<int, double>{{0, 1.0}})}};
+    testValue(MarkovChain<int>(flipFlop).stationaryDistribution(markovExecutor).probabilityOfSet({0}), 0.5, "markov_periodic_stationary");
+    std::map<int, ProbabilitySpace<int>> leaky = {{0, ProbabilitySpace<int>(std::map<int, double>{{0, 0.5}, {2, 0.5}})}};
+    testThrows([&]{ MarkovChain<int>{leaky}; }, "markov_target_without_row");
+    testThrows([&]{ weatherChain.propagate(ProbabilitySpace<int>(std::map<int, double>{{7, 1.0}})); }, "markov_unknown_state");
+
+    // Divergences walk both storages once and agree with their closed forms
+
+    ProbabilitySpace<int> fairBit(std::map<int, double>{{0, 0.5}, {1, 0.5}});
+    ProbabilitySpace<int> biasedBit(std::map<int, double>{{0, 0.25}, {1, 0.75}});
+    testValue(entropy(noppa), std::log(6.0), "entropy_of_die=log6");
+    testValue(klDivergence(fairBit, biasedBit), 0.5 * std::log(4.0/3.0), "kl_divergence_closed_form");
+    testValue(totalVariationDistance(fairBit, biasedBit), 0.25, "total_variation_closed_form");
+    testValue(hellingerDistance(fairBit, biasedBit), std::sqrt(1.0 - std::sqrt(0.125) - std::sqrt(0.375)), "hellinger_closed_form");
+    DistributionDistances bitDistances = distances(fairBit, biasedBit);
+    testValue(bitDistances.reverseKlDivergence, klDivergence(biasedBit, fairBit), "fused_distances_reverse_kl");
+    testValue(bitDistances.jsDivergence, jsDivergence(fairBit, biasedBit), "fused_distances_js");
+    ProbabilitySpace<int> sixHeavy = noppa.bayesUpdate([](int x) { return x == 6 ? 3.0 : 1.0; });
+    testValue(totalVariationDistance(noppa, sixHeavy), 5.0/24.0, "aligned_storage_total_variation");
+    ProbabilitySpace<int> onlyZero(std::map<int, double>{{0, 1.0}});
+    ProbabilitySpace<int> onlyOne(std::map<int, double>{{1, 1.0}});
+    testValue(jsDivergence(onlyZero, onlyOne, MissingOutcomes::AsZero), std::log(2.0), "js_disjoint_supports=log2");
+    testValue(klDivergence(onlyZero, fairBit, MissingOutcomes::AsZero), std::log(2.0), "kl_merge_join_missing_as_zero");
+    testValue(std::isinf(klDivergence(fairBit, onlyZero, MissingOutcomes::AsZero)), 1.0, "kl_missing_outcome_is_infinite");
+    testThrows([&]{ klDivergence(onlyZero, onlyOne); }, "divergence_different_outcomes");
+    onlyZero.setIgnoreUnknown(true);
+    onlyOne.setIgnoreUnknown(true);
+    testValue(hellingerDistance(onlyZero, onlyOne), 1.0, "divergence_follows_ignore_unknown");
+    std::vector<ProbabilitySpace<int>> monitored = {fairBit, biasedBit, onlyZero};
+    WorkStealingExecutor divergenceExecutor(4), singleExecutor(1);
+    std::vector<DistributionDistances> allPairs = pairwiseDistances(monitored, MissingOutcomes::AsZero, divergenceExecutor);
+    std::vector<DistributionDistances> serialPairs = pairwiseDistances(monitored, MissingOutcomes::AsZero, singleExecutor);
+    testValue(allPairs[0 * 3 + 1].klDivergence, klDivergence(fairBit, biasedBit), "pairwise_kl_P_from_Q");
+    testValue(allPairs[1 * 3 + 0].klDivergence, klDivergence(biasedBit, fairBit), "pairwise_kl_Q_from_P");
+    testValue(allPairs[2 * 3 + 1].totalVariation, 0.75, "pairwise_merge_join");
+    bool pairsIdentical = true;
+    for (std::size_t i = 0; i < allPairs.size(); ++i)
+        pairsIdentical = pairsIdentical && allPairs[i].jsDivergence == serialPairs[i].jsDivergence && allPairs[i].hellinger == serialPairs[i].hellinger;
+    testValue(pairsIdentical, 1.0, "pairwise_is_reproducible");
+    testThrows([&]{ pairwiseDistances(monitored, MissingOutcomes::Throw, divergenceExecutor); }, "pairwise_different_outcomes");
+
+    // Events can live in a memory resource of the client, batches use the scratch arena
+
+    unsigned char eventBuffer[1024];
+    std::pmr::monotonic_buffer_resource eventMemory(eventBuffer, sizeof(eventBuffer), std::pmr::null_memory_resource());
+    std::pmr::set<int> pmr_4_5({4, 5}, &eventMemory);
+    std::pmr::set<int> pmr_4_5_6({4, 5, 6}, &eventMemory);
+    testValue(noppa.probabilityOfSet(pmr_4_5), 1.0/3.0, "pmr_P({4,5})=1/3");
+    testValue(noppa.conditionalProbability(pmr_4_5, pmr_4_5_6), 2.0/3.0, "pmr_P({4,5}|{4,5,6})=2/3");
+    testValue(noppa.unionOfEvents(pmr_4_5, _1_2), 2.0/3.0, "pmr_mixed_P({4,5} U {1,2})=2/3");
+    testValue(noppa.tryIntersectionOfEvents(pmr_4_5, pmr_4_5_6).probability, 1.0/3.0, "pmr_try_P({4,5} n {4,5,6})=1/3");
+    testValue(noppa.probabilityOfSet(noppa.validate(pmr_4_5_6)), 0.5, "pmr_validated_P({4,5,6})=1/2");
+    testValue(noppa.conditionOn(pmr_4_5_6).probabilityOfSet(_4_5), 2.0/3.0, "pmr_condition_view");
+    testThrows([&]{ noppa.complementOfEvent(std::pmr::set<int>({7}, &eventMemory)); }, "pmr_non-defined_event");
+
+    noppa.conditionalProbabilitiesOf({_4_5, _3}, _4_5_6);
+    std::size_t arenaCapacity = scratchArena().capacity();
+    std::vector<std::set<int>> scratchA = {_4_5, _3}, scratchB = {_4_5_6, _1_2};
+    for (int i = 0; i < 100; ++i) noppa.conditionalProbabilitiesOf(scratchA, scratchB);
+    testValue(scratchArena().capacity(), static_cast<double>(arenaCapacity), "scratch_arena_is_reused_across_batches");
+    void* firstScratch;
+    {
+        ScratchScope outer;
+        firstScratch = outer.resource()->allocate(64);
+        { ScratchScope inner; (void)inner.resource()->allocate(64); }
+        testValue(outer.resource()->allocate(64) != firstScratch, 1.0, "scratch_scope_only_outermost_resets");
+    }
+    {
+        ScratchScope scope;
+        testValue(scope.resource()->allocate(64) == firstScratch, 1.0, "scratch_arena_reset_by_outermost_scope");
+    }
     
     std::cout << "----------<Probability tests>----------" << std::endl;
 